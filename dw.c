@@ -17,6 +17,7 @@
 
 #include <sys/queue.h>
 
+#include <endian.h>
 #include <errno.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -29,10 +30,13 @@
 #define nitems(_a)	(sizeof((_a)) / sizeof((_a)[0]))
 #endif
 
+/* Decoder of a value, picked by the form and byte order. */
+typedef int (*dwdec_fn)(struct dwbuf *, uint8_t, struct dwaval *);
+
 static int	 dw_read_u8(struct dwbuf *, uint8_t *);
-static int	 dw_read_u16(struct dwbuf *, uint16_t *);
-static int	 dw_read_u32(struct dwbuf *, uint32_t *);
-static int	 dw_read_u64(struct dwbuf *, uint64_t *);
+static int	 dw_read_u16(struct dwbuf *, uint16_t *, int);
+static int	 dw_read_u32(struct dwbuf *, uint32_t *, int);
+static int	 dw_read_u64(struct dwbuf *, uint64_t *, int);
 
 static int	 dw_read_sleb128(struct dwbuf *, int64_t *);
 static int	 dw_read_uleb128(struct dwbuf *, uint64_t *);
@@ -40,6 +44,7 @@ static int	 dw_read_uleb128(struct dwbuf *, uint64_t *);
 static int	 dw_read_bytes(struct dwbuf *, void *, size_t);
 static int	 dw_read_string(struct dwbuf *, const char **);
 static int	 dw_read_buf(struct dwbuf *, struct dwbuf *, size_t);
+static int	 dw_read_form(struct dwbuf *, uint64_t *);
 
 static int	 dw_skip_bytes(struct dwbuf *, size_t);
 
@@ -47,12 +52,50 @@ static int	 dw_read_filename(struct dwbuf *, const char **, const char **,
 		     uint8_t, uint64_t);
 
 
-static int	 dw_attr_parse(struct dwbuf *, struct dwattr *, uint8_t,
-		     struct dwaval_queue *);
-static void	 dw_attr_purge(struct dwaval_queue *);
-static int	 dw_die_parse(struct dwbuf *, size_t, uint8_t,
-		     struct dwabbrev_queue *, struct dwdie_queue *);
-static void	 dw_die_purge(struct dwdie_queue *);
+static int	 dw_attr_parse(struct dwbuf *, struct dwattr *, uint8_t, int,
+		     struct dwaval *);
+static const struct dwreloc *dw_reloc_find(const struct dwrelocs *, uint64_t,
+		     size_t *);
+static uint64_t	 dw_reloc_field(const struct dwrelocs *, uint64_t,
+		     size_t, uint64_t);
+static int	 dw_aval_reloc(struct dwcu *, const char *, const char *,
+		     struct dwaval *);
+static int	 dw_die_reloc(struct dwcu *, const char *, const char *,
+		     struct dwabbrev *, struct dwaval *);
+static int	 dw_die_header(struct dwbuf *, struct dwcu *, struct dwdie *);
+static int	 dw_die_values(struct dwbuf *, struct dwcu *, struct dwdie *,
+		     struct dwaval *);
+static void	*dw_die_grow(void *, size_t *, size_t);
+static int	 dw_die_parse(struct dwbuf *, struct dwcu *);
+static int	 dw_cu_header(struct dwbuf *, struct dwbuf *, size_t,
+		     const struct dwrelocs *, struct dwabcache *,
+		     struct dwarena *, int, struct dwcu **);
+
+static int	 dw_form_size(uint64_t, uint8_t);
+static int	 dw_form_skip(struct dwbuf *, uint64_t, uint8_t,
+		     const dwdec_fn *);
+static int	 dw_die_skip(struct dwbuf *, struct dwabbrev *, uint8_t,
+		     const dwdec_fn *);
+static int	 dw_ab_plan(struct dwabbrev *, struct dwarena *);
+
+static int	 dw_ab_index(struct dwabtab *, struct dwarena *);
+
+static struct dwchunk *dw_arena_chunk(struct dwarena *, size_t);
+
+static int	 dw_abcache_grow(struct dwabcache *);
+
+struct dwchunk {
+	SLIST_ENTRY(dwchunk)	 dch_next;
+	size_t			 dch_size;	/* usable bytes */
+	size_t			 dch_used;
+};
+
+#define DW_ARENA_ALIGN		sizeof(uint64_t)
+#define DW_ARENA_ROUND(_sz)	(((_sz) + DW_ARENA_ALIGN - 1) &		\
+				    ~(DW_ARENA_ALIGN - 1))
+#define DW_CHUNK_HDRSZ		DW_ARENA_ROUND(sizeof(struct dwchunk))
+#define DW_CHUNK_DATA(_dch)	((char *)(_dch) + DW_CHUNK_HDRSZ)
+#define DW_CHUNK_SIZE		(64 * 1024)
 
 static int
 dw_read_bytes(struct dwbuf *d, void *v, size_t n)
@@ -71,22 +114,139 @@ dw_read_u8(struct dwbuf *d, uint8_t *v)
 	return dw_read_bytes(d, v, sizeof(*v));
 }
 
-static int
-dw_read_u16(struct dwbuf *d, uint16_t *v)
+/*
+ * Multi-byte values are read in the byte order of the segment, big-endian
+ * if ``msb'' is set.  Callers in hot paths pass a constant so that each
+ * order gets its own code.
+ */
+static inline int
+dw_read_u16(struct dwbuf *d, uint16_t *v, const int msb)
 {
-	return dw_read_bytes(d, v, sizeof(*v));
+	if (dw_read_bytes(d, v, sizeof(*v)))
+		return -1;
+	*v = msb ? be16toh(*v) : le16toh(*v);
+	return 0;
 }
 
-static int
-dw_read_u32(struct dwbuf *d, uint32_t *v)
+static inline int
+dw_read_u32(struct dwbuf *d, uint32_t *v, const int msb)
 {
-	return dw_read_bytes(d, v, sizeof(*v));
+	if (dw_read_bytes(d, v, sizeof(*v)))
+		return -1;
+	*v = msb ? be32toh(*v) : le32toh(*v);
+	return 0;
 }
 
-static int
-dw_read_u64(struct dwbuf *d, uint64_t *v)
+static inline int
+dw_read_u64(struct dwbuf *d, uint64_t *v, const int msb)
 {
-	return dw_read_bytes(d, v, sizeof(*v));
+	if (dw_read_bytes(d, v, sizeof(*v)))
+		return -1;
+	*v = msb ? be64toh(*v) : le64toh(*v);
+	return 0;
+}
+
+/*
+ * Unchecked versions of the readers above, for callers that already
+ * made sure enough bytes are left.
+ */
+#define DW_GET(d, v)							\
+do {									\
+	memcpy((v), (d)->buf, sizeof(*(v)));				\
+	(d)->buf += sizeof(*(v));					\
+	(d)->len -= sizeof(*(v));					\
+} while (0)
+
+static inline int
+dw_get_u8(struct dwbuf *d, uint8_t *v)
+{
+	*v = *(const uint8_t *)d->buf;
+	d->buf++;
+	d->len--;
+	return 0;
+}
+
+static inline int
+dw_get_u16(struct dwbuf *d, uint16_t *v, const int msb)
+{
+	DW_GET(d, v);
+	*v = msb ? be16toh(*v) : le16toh(*v);
+	return 0;
+}
+
+static inline int
+dw_get_u32(struct dwbuf *d, uint32_t *v, const int msb)
+{
+	DW_GET(d, v);
+	*v = msb ? be32toh(*v) : le32toh(*v);
+	return 0;
+}
+
+static inline int
+dw_get_u64(struct dwbuf *d, uint64_t *v, const int msb)
+{
+	DW_GET(d, v);
+	*v = msb ? be64toh(*v) : le64toh(*v);
+	return 0;
+}
+
+#define DW_LEB128_MAX	10	/* bytes needed to encode 64 bits */
+
+/*
+ * Decode a LEB128 value when at least DW_LEB128_MAX bytes are left.
+ * Values encoded in up to 8 bytes, so all of them in practice, are
+ * decoded from a single little-endian load: the first byte without
+ * continuation bit gives the length and the 7-bit groups are packed
+ * together in three steps, without looping over the bytes.
+ */
+static inline int
+dw_read_leb128_fast(struct dwbuf *d, uint64_t *v, int signextend)
+{
+	const uint8_t *p = (const uint8_t *)d->buf;
+	unsigned int n, shift;
+	uint64_t w, stop, res;
+
+	/* One byte values are by far the most common ones. */
+	if ((p[0] & 0x80) == 0) {
+		res = p[0];
+		n = 1;
+		goto done;
+	}
+
+	memcpy(&w, p, sizeof(w));
+	w = le64toh(w);
+	stop = ~w & 0x8080808080808080ULL;
+	if (stop == 0) {
+		/* 9 or 10 bytes. */
+		res = 0;
+		for (n = 0, shift = 0; n < DW_LEB128_MAX; n++, shift += 7) {
+			res |= (uint64_t)(p[n] & 0x7f) << shift;
+			if ((p[n] & 0x80) == 0)
+				break;
+		}
+		if (n == DW_LEB128_MAX)
+			return -1;
+		n++;
+		goto done;
+	}
+
+	n = __builtin_ctzll(stop) / 8 + 1;
+	if (n < sizeof(w))
+		w &= (1ULL << (n * 8)) - 1;
+
+	res = (w & 0x007f007f007f007fULL) | ((w & 0x7f007f007f007f00ULL) >> 1);
+	res = (res & 0x00003fff00003fffULL) | ((res & 0x3fff00003fff0000ULL) >> 2);
+	res = (res & 0x000000000fffffffULL) | ((res & 0x0fffffff00000000ULL) >> 4);
+
+done:
+	shift = n * 7;
+	if (signextend && shift < 64 && (p[n - 1] & 0x40) != 0)
+		res |= ~(uint64_t)0 << shift;
+
+	*v = res;
+	d->buf += n;
+	d->len -= n;
+	return 0;
 }
 
 /* Read a DWARF LEB128 (little-endian base-128) value. */
@@ -97,6 +257,10 @@ dw_read_leb128(struct dwbuf *d, uint64_t *v, int signextend)
 	uint64_t res = 0;
 	uint8_t x;
 
+	if (d->len >= DW_LEB128_MAX)
+		return dw_read_leb128_fast(d, v, signextend);
+
+	/* Close to the end of the buffer, check every byte. */
 	while (shift < 64 && !dw_read_u8(d, &x)) {
 		res |= (uint64_t)(x & 0x7f) << shift;
 		shift += 7;
@@ -110,6 +274,18 @@ dw_read_leb128(struct dwbuf *d, uint64_t *v, int signextend)
 	return -1;
 }
 
+static inline int
+dw_get_sleb128(struct dwbuf *d, int64_t *v)
+{
+	return dw_read_leb128_fast(d, (uint64_t *)v, 1);
+}
+
+static inline int
+dw_get_uleb128(struct dwbuf *d, uint64_t *v)
+{
+	return dw_read_leb128_fast(d, v, 0);
+}
+
 static int
 dw_read_sleb128(struct dwbuf *d, int64_t *v)
 {
@@ -274,193 +450,826 @@ dw_op2name(uint8_t op)
 	return NULL;
 }
 
-static int
-dw_attr_parse(struct dwbuf *dwbuf, struct dwattr *dat, uint8_t psz,
-    struct dwaval_queue *davq)
+/*
+ * Values are decoded by functions indexed by an opcode, computed once
+ * per attribute when parsing abbreviations.
+ */
+enum dwdec_op {
+	DWD_UNKNOWN = 0,
+	DWD_ADDR,
+	DWD_BLOCK1,
+	DWD_BLOCK2,
+	DWD_BLOCK4,
+	DWD_BLOCK,
+	DWD_U8,
+	DWD_U16,
+	DWD_U32,
+	DWD_U64,
+	DWD_ULEB128,
+	DWD_SLEB128,
+	DWD_STRING,
+	DWD_FLAG_PRESENT,
+	DWD_INDIRECT,
+	DWD_MAX
+};
+
+static inline int
+dw_dec_addr(struct dwbuf *d, uint8_t psz, struct dwaval *dav, const int msb)
 {
-	struct dwaval	*dav;
-	uint64_t	 form = dat->dat_form;
-	int		 error = 0, i = 0;
+	if (psz == sizeof(uint32_t))
+		return dw_read_u32(d, &dav->dav_u32, msb);
+	return dw_read_u64(d, &dav->dav_u64, msb);
+}
 
-	while (form == DW_FORM_indirect) {
-		/* XXX loop prevention not strict enough? */
-		if (dw_read_uleb128(dwbuf, &form) || (++i > 3))
-			return ELOOP;
+static inline int
+dw_dec_block1(struct dwbuf *d, uint8_t psz, struct dwaval *dav, const int msb)
+{
+	if (dw_read_u8(d, &dav->dav_u8))
+		return -1;
+	return dw_read_buf(d, &dav->dav_buf, dav->dav_u8);
+}
+
+static inline int
+dw_dec_block2(struct dwbuf *d, uint8_t psz, struct dwaval *dav, const int msb)
+{
+	if (dw_read_u16(d, &dav->dav_u16, msb))
+		return -1;
+	return dw_read_buf(d, &dav->dav_buf, dav->dav_u16);
+}
+
+static inline int
+dw_dec_block4(struct dwbuf *d, uint8_t psz, struct dwaval *dav, const int msb)
+{
+	if (dw_read_u32(d, &dav->dav_u32, msb))
+		return -1;
+	return dw_read_buf(d, &dav->dav_buf, dav->dav_u32);
+}
+
+static inline int
+dw_dec_block(struct dwbuf *d, uint8_t psz, struct dwaval *dav, const int msb)
+{
+	if (dw_read_uleb128(d, &dav->dav_u64))
+		return -1;
+	return dw_read_buf(d, &dav->dav_buf, dav->dav_u64);
+}
+
+static inline int
+dw_dec_u8(struct dwbuf *d, uint8_t psz, struct dwaval *dav, const int msb)
+{
+	return dw_read_u8(d, &dav->dav_u8);
+}
+
+static inline int
+dw_dec_u16(struct dwbuf *d, uint8_t psz, struct dwaval *dav, const int msb)
+{
+	return dw_read_u16(d, &dav->dav_u16, msb);
+}
+
+static inline int
+dw_dec_u32(struct dwbuf *d, uint8_t psz, struct dwaval *dav, const int msb)
+{
+	return dw_read_u32(d, &dav->dav_u32, msb);
+}
+
+static inline int
+dw_dec_u64(struct dwbuf *d, uint8_t psz, struct dwaval *dav, const int msb)
+{
+	return dw_read_u64(d, &dav->dav_u64, msb);
+}
+
+static inline int
+dw_dec_uleb128(struct dwbuf *d, uint8_t psz, struct dwaval *dav, const int msb)
+{
+	return dw_read_uleb128(d, &dav->dav_u64);
+}
+
+static inline int
+dw_dec_sleb128(struct dwbuf *d, uint8_t psz, struct dwaval *dav, const int msb)
+{
+	return dw_read_sleb128(d, &dav->dav_s64);
+}
+
+static inline int
+dw_dec_string(struct dwbuf *d, uint8_t psz, struct dwaval *dav, const int msb)
+{
+	return dw_read_string(d, &dav->dav_str);
+}
+
+static inline int
+dw_dec_flag_present(struct dwbuf *d, uint8_t psz, struct dwaval *dav,
+    const int msb)
+{
+	dav->dav_u8 = 1;
+	return 0;
+}
+
+static inline int
+dw_dec_unknown(struct dwbuf *d, uint8_t psz, struct dwaval *dav, const int msb)
+{
+	return ENOENT;
+}
+
+static int	 dw_dec_indirect_le(struct dwbuf *, uint8_t, struct dwaval *);
+static int	 dw_dec_indirect_be(struct dwbuf *, uint8_t, struct dwaval *);
+
+#define DW_DECODER1(name, order, msb)					\
+static int								\
+dw_dec_##name##_##order(struct dwbuf *d, uint8_t psz, struct dwaval *dav) \
+{									\
+	return dw_dec_##name(d, psz, dav, msb);				\
+}
+
+#define DW_DECODER(name)						\
+	DW_DECODER1(name, le, 0)					\
+	DW_DECODER1(name, be, 1)
+
+DW_DECODER(addr)
+DW_DECODER(block1)
+DW_DECODER(block2)
+DW_DECODER(block4)
+DW_DECODER(block)
+DW_DECODER(u8)
+DW_DECODER(u16)
+DW_DECODER(u32)
+DW_DECODER(u64)
+DW_DECODER(uleb128)
+DW_DECODER(sleb128)
+DW_DECODER(string)
+DW_DECODER(flag_present)
+DW_DECODER(unknown)
+
+#define DW_DEC(name, order)	dw_dec_##name##_##order
+
+#define DW_DECODERS(o)							\
+	{								\
+		[DWD_UNKNOWN]		= DW_DEC(unknown, o),		\
+		[DWD_ADDR]		= DW_DEC(addr, o),		\
+		[DWD_BLOCK1]		= DW_DEC(block1, o),		\
+		[DWD_BLOCK2]		= DW_DEC(block2, o),		\
+		[DWD_BLOCK4]		= DW_DEC(block4, o),		\
+		[DWD_BLOCK]		= DW_DEC(block, o),		\
+		[DWD_U8]		= DW_DEC(u8, o),		\
+		[DWD_U16]		= DW_DEC(u16, o),		\
+		[DWD_U32]		= DW_DEC(u32, o),		\
+		[DWD_U64]		= DW_DEC(u64, o),		\
+		[DWD_ULEB128]		= DW_DEC(uleb128, o),		\
+		[DWD_SLEB128]		= DW_DEC(sleb128, o),		\
+		[DWD_STRING]		= DW_DEC(string, o),		\
+		[DWD_FLAG_PRESENT]	= DW_DEC(flag_present, o),	\
+		[DWD_INDIRECT]		= dw_dec_indirect_##o,		\
 	}
 
-	dav = calloc(1, sizeof(*dav));
-	if (dav == NULL)
-		return ENOMEM;
+/* Indexed by byte order, big-endian last. */
+static const dwdec_fn dw_decoders[2][DWD_MAX] = {
+	DW_DECODERS(le),
+	DW_DECODERS(be),
+};
 
-	dav->dav_dat = dat;
+/*
+ * Unchecked decoders of the values of bounded size, run on the leading
+ * values of a DIE when their maximum size is left.  Their tables are
+ * also indexed by the size of addresses, known when one is picked.
+ */
+static inline int
+dw_fast_addr(struct dwbuf *d, uint8_t psz, struct dwaval *dav, const int msb)
+{
+	if (psz == sizeof(uint32_t))
+		return dw_get_u32(d, &dav->dav_u32, msb);
+	return dw_get_u64(d, &dav->dav_u64, msb);
+}
+
+static inline int
+dw_fast_u8(struct dwbuf *d, uint8_t psz, struct dwaval *dav, const int msb)
+{
+	return dw_get_u8(d, &dav->dav_u8);
+}
+
+static inline int
+dw_fast_u16(struct dwbuf *d, uint8_t psz, struct dwaval *dav, const int msb)
+{
+	return dw_get_u16(d, &dav->dav_u16, msb);
+}
+
+static inline int
+dw_fast_u32(struct dwbuf *d, uint8_t psz, struct dwaval *dav, const int msb)
+{
+	return dw_get_u32(d, &dav->dav_u32, msb);
+}
+
+static inline int
+dw_fast_u64(struct dwbuf *d, uint8_t psz, struct dwaval *dav, const int msb)
+{
+	return dw_get_u64(d, &dav->dav_u64, msb);
+}
+
+static inline int
+dw_fast_uleb128(struct dwbuf *d, uint8_t psz, struct dwaval *dav,
+    const int msb)
+{
+	return dw_get_uleb128(d, &dav->dav_u64);
+}
+
+static inline int
+dw_fast_sleb128(struct dwbuf *d, uint8_t psz, struct dwaval *dav,
+    const int msb)
+{
+	return dw_get_sleb128(d, &dav->dav_s64);
+}
+
+#define DW_FAST1(name, order, msb)					\
+static int								\
+dw_fast_##name##_##order(struct dwbuf *d, uint8_t psz, struct dwaval *dav) \
+{									\
+	return dw_fast_##name(d, psz, dav, msb);			\
+}
+
+#define DW_FAST(name)							\
+	DW_FAST1(name, le, 0)						\
+	DW_FAST1(name, be, 1)
+
+#define DW_FAST_ADDR1(asz, order, msb)					\
+static int								\
+dw_fast_addr##asz##_##order(struct dwbuf *d, uint8_t psz,		\
+    struct dwaval *dav)							\
+{									\
+	return dw_fast_addr(d, asz, dav, msb);				\
+}
+
+#define DW_FAST_ADDR(asz)						\
+	DW_FAST_ADDR1(asz, le, 0)					\
+	DW_FAST_ADDR1(asz, be, 1)
+
+DW_FAST_ADDR(4)
+DW_FAST_ADDR(8)
+DW_FAST(u8)
+DW_FAST(u16)
+DW_FAST(u32)
+DW_FAST(u64)
+DW_FAST(uleb128)
+DW_FAST(sleb128)
+
+#define DW_FST(name, order)	dw_fast_##name##_##order
+
+/* Values of unbounded size keep their checked decoder. */
+#define DW_FAST_DECODERS(o, asz)					\
+	{								\
+		[DWD_UNKNOWN]		= DW_DEC(unknown, o),		\
+		[DWD_ADDR]		= DW_FST(addr##asz, o),		\
+		[DWD_BLOCK1]		= DW_DEC(block1, o),		\
+		[DWD_BLOCK2]		= DW_DEC(block2, o),		\
+		[DWD_BLOCK4]		= DW_DEC(block4, o),		\
+		[DWD_BLOCK]		= DW_DEC(block, o),		\
+		[DWD_U8]		= DW_FST(u8, o),		\
+		[DWD_U16]		= DW_FST(u16, o),		\
+		[DWD_U32]		= DW_FST(u32, o),		\
+		[DWD_U64]		= DW_FST(u64, o),		\
+		[DWD_ULEB128]		= DW_FST(uleb128, o),		\
+		[DWD_SLEB128]		= DW_FST(sleb128, o),		\
+		[DWD_STRING]		= DW_DEC(string, o),		\
+		[DWD_FLAG_PRESENT]	= DW_DEC(flag_present, o),	\
+		[DWD_INDIRECT]		= dw_dec_indirect_##o,		\
+	}
 
+/* Indexed by byte order, then by address size, 4 bytes first. */
+static const dwdec_fn dw_fast_decoders[2][2][DWD_MAX] = {
+	{ DW_FAST_DECODERS(le, 4), DW_FAST_DECODERS(le, 8) },
+	{ DW_FAST_DECODERS(be, 4), DW_FAST_DECODERS(be, 8) },
+};
+
+static uint8_t
+dw_form2op(uint64_t form)
+{
 	switch (form) {
 	case DW_FORM_addr:
 	case DW_FORM_ref_addr:
-		if (psz == sizeof(uint32_t))
-			error = dw_read_u32(dwbuf, &dav->dav_u32);
-		else
-			error = dw_read_u64(dwbuf, &dav->dav_u64);
-		break;
+		return DWD_ADDR;
 	case DW_FORM_block1:
-		error = dw_read_u8(dwbuf, &dav->dav_u8);
-		if (error == 0)
-			error = dw_read_buf(dwbuf, &dav->dav_buf, dav->dav_u8);
-		break;
+		return DWD_BLOCK1;
 	case DW_FORM_block2:
-		error = dw_read_u16(dwbuf, &dav->dav_u16);
-		if (error == 0)
-			error = dw_read_buf(dwbuf, &dav->dav_buf, dav->dav_u16);
-		break;
+		return DWD_BLOCK2;
 	case DW_FORM_block4:
-		error = dw_read_u32(dwbuf, &dav->dav_u32);
-		if (error == 0)
-			error = dw_read_buf(dwbuf, &dav->dav_buf, dav->dav_u32);
-		break;
+		return DWD_BLOCK4;
 	case DW_FORM_block:
-		error = dw_read_uleb128(dwbuf, &dav->dav_u64);
-		if (error == 0)
-			error = dw_read_buf(dwbuf, &dav->dav_buf, dav->dav_u64);
-		break;
+		return DWD_BLOCK;
 	case DW_FORM_data1:
 	case DW_FORM_flag:
 	case DW_FORM_ref1:
-		error = dw_read_u8(dwbuf, &dav->dav_u8);
-		break;
+		return DWD_U8;
 	case DW_FORM_data2:
 	case DW_FORM_ref2:
-		error = dw_read_u16(dwbuf, &dav->dav_u16);
-		break;
+		return DWD_U16;
 	case DW_FORM_data4:
 	case DW_FORM_ref4:
-		error = dw_read_u32(dwbuf, &dav->dav_u32);
-		break;
+	case DW_FORM_strp:
+		return DWD_U32;
 	case DW_FORM_data8:
 	case DW_FORM_ref8:
-		error = dw_read_u64(dwbuf, &dav->dav_u64);
-		break;
+		return DWD_U64;
 	case DW_FORM_ref_udata:
 	case DW_FORM_udata:
-		error = dw_read_uleb128(dwbuf, &dav->dav_u64);
-		break;
+		return DWD_ULEB128;
 	case DW_FORM_sdata:
-		error = dw_read_sleb128(dwbuf, &dav->dav_s64);
-		break;
+		return DWD_SLEB128;
 	case DW_FORM_string:
-		error = dw_read_string(dwbuf, &dav->dav_str);
-		break;
-	case DW_FORM_strp:
-		error = dw_read_u32(dwbuf, &dav->dav_u32);
-		break;
+		return DWD_STRING;
 	case DW_FORM_flag_present:
-		dav->dav_u8 = 1;
-		break;
+		return DWD_FLAG_PRESENT;
+	case DW_FORM_indirect:
+		return DWD_INDIRECT;
 	default:
-		error = ENOENT;
-		break;
+		return DWD_UNKNOWN;
 	}
+}
 
-	if (error) {
-		free(dav);
-		return error;
+/* Read the actual form of a DW_FORM_indirect value, which precedes it. */
+static int
+dw_read_form(struct dwbuf *d, uint64_t *formp)
+{
+	int		 i = 0;
+
+	while (*formp == DW_FORM_indirect) {
+		/* XXX loop prevention not strict enough? */
+		if (dw_read_uleb128(d, formp) || (++i > 3))
+			return ELOOP;
 	}
 
-	SIMPLEQ_INSERT_TAIL(davq, dav, dav_next);
 	return 0;
 }
 
-static void
-dw_attr_purge(struct dwaval_queue *davq)
+static inline int
+dw_dec_indirect(struct dwbuf *d, uint8_t psz, struct dwaval *dav,
+    const int msb)
 {
-	struct dwaval	*dav;
+	uint64_t	 form = DW_FORM_indirect;
+	int		 error;
 
-	while ((dav = SIMPLEQ_FIRST(davq)) != NULL) {
-		SIMPLEQ_REMOVE_HEAD(davq, dav_next);
-		free(dav);
-	}
+	error = dw_read_form(d, &form);
+	if (error != 0)
+		return error;
 
-	SIMPLEQ_INIT(davq);
+	return dw_decoders[msb][dw_form2op(form)](d, psz, dav);
 }
 
 static int
-dw_die_parse(struct dwbuf *dwbuf, size_t nextoff, uint8_t psz,
-    struct dwabbrev_queue *dabq, struct dwdie_queue *dieq)
+dw_dec_indirect_le(struct dwbuf *d, uint8_t psz, struct dwaval *dav)
 {
-	struct dwdie	*die;
-	struct dwabbrev	*dab;
-	struct dwattr	*dat;
-	uint64_t	 code;
-	size_t		 doff;
-	uint8_t		 lvl = 0;
-	int		 error;
-
-
-	while (dwbuf->len > 0) {
-		doff = nextoff - dwbuf->len;
-		if (dw_read_uleb128(dwbuf, &code))
-			return -1;
+	return dw_dec_indirect(d, psz, dav, 0);
+}
 
-		if (code == 0) {
-			lvl--;
-			continue;
-		}
+static int
+dw_dec_indirect_be(struct dwbuf *d, uint8_t psz, struct dwaval *dav)
+{
+	return dw_dec_indirect(d, psz, dav, 1);
+}
 
-		SIMPLEQ_FOREACH(dab, dabq, dab_next) {
-			if (dab->dab_code == code)
-				break;
-		}
-		if (dab == NULL)
-			return ESRCH;
+static int
+dw_attr_parse(struct dwbuf *dwbuf, struct dwattr *dat, uint8_t psz, int msb,
+    struct dwaval *dav)
+{
+	memset(dav, 0, sizeof(*dav));
+	dav->dav_dat = dat;
 
-		die = malloc(sizeof(*die));
-		if (die == NULL)
-			return ENOMEM;
+	return dw_decoders[msb][dw_form2op(dat->dat_form)](dwbuf, psz, dav);
+}
 
-		die->die_lvl = lvl;
-		die->die_dab = dab;
-		die->die_offset = doff;
-		SIMPLEQ_INIT(&die->die_avals);
+/*
+ * Decode the values of a DIE running the decoders of its abbreviation.
+ * If the maximum size of its leading values of bounded size is left,
+ * bounds are checked once for all of them and they are decoded by the
+ * unchecked decoders.
+ */
+static inline int
+dw_attr_parse_all(struct dwbuf *dwbuf, struct dwabbrev *dab, uint8_t psz,
+    struct dwaval *dav, const int msb)
+{
+	const dwdec_fn	*decoders = dw_decoders[msb];
+	const dwdec_fn	*fast = dw_fast_decoders[msb][psz != sizeof(uint32_t)];
+	const uint8_t	*op = dab->dab_ops;
+	struct dwattr	*dat = SIMPLEQ_FIRST(&dab->dab_attrs);
+	size_t		 i;
+	int		 error;
 
-		SIMPLEQ_FOREACH(dat, &dab->dab_attrs, dat_next) {
-			error = dw_attr_parse(dwbuf, dat, psz, &die->die_avals);
-			if (error != 0) {
-				dw_attr_purge(&die->die_avals);
+	if (dwbuf->len >= dab->dab_bound) {
+		for (i = 0; i < dab->dab_nbounded; i++) {
+			memset(dav, 0, sizeof(*dav));
+			dav->dav_dat = dat;
+			error = fast[*op++](dwbuf, psz, dav++);
+			if (error != 0)
 				return error;
-			}
+			dat = SIMPLEQ_NEXT(dat, dat_next);
 		}
+	}
 
-		if (dab->dab_children == DW_CHILDREN_yes)
-			lvl++;
-
-		SIMPLEQ_INSERT_TAIL(dieq, die, die_next);
+	for (; dat != NULL; dat = SIMPLEQ_NEXT(dat, dat_next)) {
+		memset(dav, 0, sizeof(*dav));
+		dav->dav_dat = dat;
+		error = decoders[*op++](dwbuf, psz, dav++);
+		if (error != 0)
+			return error;
 	}
 
 	return 0;
 }
 
-static void
-dw_die_purge(struct dwdie_queue *dieq)
-{
-	struct dwdie	*die;
-
-	while ((die = SIMPLEQ_FIRST(dieq)) != NULL) {
-		SIMPLEQ_REMOVE_HEAD(dieq, die_next);
-		dw_attr_purge(&die->die_avals);
-		free(die);
-	}
+typedef int (*dwparse_fn)(struct dwbuf *, struct dwabbrev *, uint8_t,
+    struct dwaval *);
 
-	SIMPLEQ_INIT(dieq);
+static int
+dw_attr_parse_all_le(struct dwbuf *dwbuf, struct dwabbrev *dab, uint8_t psz,
+    struct dwaval *dav)
+{
+	return dw_attr_parse_all(dwbuf, dab, psz, dav, 0);
 }
 
-int
-dw_ab_parse(struct dwbuf *abseg, struct dwabbrev_queue *dabq)
+static int
+dw_attr_parse_all_be(struct dwbuf *dwbuf, struct dwabbrev *dab, uint8_t psz,
+    struct dwaval *dav)
 {
-	struct dwabbrev	*dab;
-	uint64_t	 code, tag;
-	uint8_t		 children;
+	return dw_attr_parse_all(dwbuf, dab, psz, dav, 1);
+}
 
-	if (abseg->len == 0)
-		return EINVAL;
+/* Indexed by byte order, big-endian last. */
+static const dwparse_fn dw_parsers[2] = {
+	dw_attr_parse_all_le,
+	dw_attr_parse_all_be,
+};
+
+/* Size of a value of the given form, -1 if it is not fixed. */
+static int
+dw_form_size(uint64_t form, uint8_t psz)
+{
+	switch (form) {
+	case DW_FORM_addr:
+	case DW_FORM_ref_addr:
+		return (psz == sizeof(uint32_t)) ? 4 : 8;
+	case DW_FORM_data1:
+	case DW_FORM_flag:
+	case DW_FORM_ref1:
+		return 1;
+	case DW_FORM_data2:
+	case DW_FORM_ref2:
+		return 2;
+	case DW_FORM_data4:
+	case DW_FORM_ref4:
+	case DW_FORM_strp:
+		return 4;
+	case DW_FORM_data8:
+	case DW_FORM_ref8:
+		return 8;
+	case DW_FORM_flag_present:
+		return 0;
+	default:
+		return -1;
+	}
+}
+
+/* Skip a value without decoding it. */
+static int
+dw_form_skip(struct dwbuf *dwbuf, uint64_t form, uint8_t psz,
+    const dwdec_fn *decoders)
+{
+	struct dwaval	 dav;
+	int		 size;
+
+	size = dw_form_size(form, psz);
+	if (size >= 0)
+		return dw_skip_bytes(dwbuf, size);
+
+	/* Blocks only read their length, indirect values their form. */
+	return decoders[dw_form2op(form)](dwbuf, psz, &dav);
+}
+
+/* Skip the values of a DIE following the plan of its abbreviation. */
+static int
+dw_die_skip(struct dwbuf *dwbuf, struct dwabbrev *dab, uint8_t psz,
+    const dwdec_fn *decoders)
+{
+	struct dwskip	*dsk;
+	size_t		 i, asz;
+	int		 error;
+
+	asz = (psz == sizeof(uint32_t)) ? 4 : 8;
+
+	for (i = 0; i < dab->dab_nskips; i++) {
+		dsk = &dab->dab_skips[i];
+		if (dw_skip_bytes(dwbuf, dsk->dsk_fixed + dsk->dsk_naddr * asz))
+			return -1;
+		if (i == dab->dab_nskips - 1)
+			break;
+		error = dw_form_skip(dwbuf, dsk->dsk_form, psz, decoders);
+		if (error != 0)
+			return error;
+	}
+
+	return 0;
+}
+
+/*
+ * First relocation at or after ``off'', NULL if there is none.  Values
+ * are mostly read in order, so if ``hintp'' is not NULL the index found
+ * by the previous lookup is tried before searching.
+ */
+static const struct dwreloc *
+dw_reloc_find(const struct dwrelocs *drs, uint64_t off, size_t *hintp)
+{
+	const struct dwreloc *rels = drs->drs_relocs;
+	size_t		 lo = 0, hi = drs->drs_nrelocs, mid;
+
+	if (hintp != NULL && *hintp <= hi &&
+	    (*hintp == hi || rels[*hintp].drl_offset >= off) &&
+	    (*hintp == 0 || rels[*hintp - 1].drl_offset < off))
+		lo = hi = *hintp;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (rels[mid].drl_offset < off)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if (hintp != NULL)
+		*hintp = lo;
+
+	if (lo == drs->drs_nrelocs)
+		return NULL;
+
+	return &rels[lo];
+}
+
+/* Value of the field of ``size'' bytes at ``off'' once relocated. */
+static uint64_t
+dw_reloc_field(const struct dwrelocs *drs, uint64_t off, size_t size,
+    uint64_t v)
+{
+	const struct dwreloc *drl;
+
+	drl = dw_reloc_find(drs, off, NULL);
+	if (drl != NULL && drl->drl_offset == off && drl->drl_size == size)
+		return drl->drl_value;
+
+	return v;
+}
+
+/*
+ * Apply the relocations of the bytes, from ``start'' to ``end'', a value
+ * has been decoded from.  Blocks are copied before being patched, for
+ * the lifetime of the DIE if the unit is walked, of the unit otherwise.
+ */
+static int
+dw_aval_reloc(struct dwcu *dcu, const char *start, const char *end,
+    struct dwaval *dav)
+{
+	const struct dwrelocs	*drs = dcu->dcu_relocs;
+	const struct dwreloc	*drl, *edrl;
+	struct dwbuf		 dwbuf;
+	uint64_t		 off, endoff, boff = 0;
+	uint64_t		 form = dav->dav_dat->dat_form;
+	char			*copy = NULL;
+	uint32_t		 v32;
+	uint64_t		 v64;
+	int			 error;
+
+	/* Relocations apply to the value following an indirect form. */
+	if (form == DW_FORM_indirect) {
+		dwbuf.buf = start;
+		dwbuf.len = end - start;
+		error = dw_read_form(&dwbuf, &form);
+		if (error != 0)
+			return error;
+		start = dwbuf.buf;
+	}
+
+	off = start - dcu->dcu_seg;
+	endoff = end - dcu->dcu_seg;
+	edrl = drs->drs_relocs + drs->drs_nrelocs;
+
+	drl = dw_reloc_find(drs, off, &dcu->dcu_nextreloc);
+	for (; drl != NULL && drl < edrl; drl++) {
+		if (drl->drl_offset + drl->drl_size > endoff)
+			break;
+
+		switch (dw_form2op(form)) {
+		case DWD_ADDR:
+		case DWD_U32:
+		case DWD_U64:
+			if (drl->drl_offset != off ||
+			    drl->drl_size != endoff - off)
+				break;
+			if (drl->drl_size == sizeof(uint32_t))
+				dav->dav_u32 = drl->drl_value;
+			else
+				dav->dav_u64 = drl->drl_value;
+			break;
+		case DWD_BLOCK1:
+		case DWD_BLOCK2:
+		case DWD_BLOCK4:
+		case DWD_BLOCK:
+			if (copy == NULL) {
+				/* Relocations of the length are ignored. */
+				boff = dav->dav_buf.buf - dcu->dcu_seg;
+				if (drl->drl_offset < boff)
+					break;
+				copy = dw_arena_alloc(
+				    (dcu->dcu_flags & DW_CU_WALK) ?
+				    &dcu->dcu_scratch : dcu->dcu_arena,
+				    dav->dav_buf.len);
+				if (copy == NULL)
+					return ENOMEM;
+				memcpy(copy, dav->dav_buf.buf,
+				    dav->dav_buf.len);
+				dav->dav_buf.buf = copy;
+			}
+			/* Patch in the byte order of the segment. */
+			if (drl->drl_size == sizeof(uint32_t)) {
+				v32 = DWCU_MSB(dcu) ? htobe32(drl->drl_value) :
+				    htole32(drl->drl_value);
+				memcpy(copy + drl->drl_offset - boff, &v32,
+				    sizeof(v32));
+			} else {
+				v64 = DWCU_MSB(dcu) ? htobe64(drl->drl_value) :
+				    htole64(drl->drl_value);
+				memcpy(copy + drl->drl_offset - boff, &v64,
+				    sizeof(v64));
+			}
+			break;
+		default:
+			break;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Apply the relocations of the values of a DIE decoded from ``start''
+ * to ``end''.  Most DIEs have none, so look for one before finding out
+ * where each value starts.
+ */
+static int
+dw_die_reloc(struct dwcu *dcu, const char *start, const char *end,
+    struct dwabbrev *dab, struct dwaval *dav)
+{
+	const struct dwreloc	*drl;
+	struct dwbuf		 dwbuf;
+	struct dwattr		*dat;
+	const char		*vstart;
+	int			 error;
+
+	drl = dw_reloc_find(dcu->dcu_relocs, start - dcu->dcu_seg,
+	    &dcu->dcu_nextreloc);
+	if (drl == NULL || drl->drl_offset >= (uint64_t)(end - dcu->dcu_seg))
+		return 0;
+
+	dwbuf.buf = start;
+	dwbuf.len = end - start;
+
+	SIMPLEQ_FOREACH(dat, &dab->dab_attrs, dat_next) {
+		vstart = dwbuf.buf;
+		error = dw_form_skip(&dwbuf, dat->dat_form, dcu->dcu_psize,
+		    dw_decoders[DWCU_MSB(dcu)]);
+		if (error != 0)
+			return error;
+		error = dw_aval_reloc(dcu, vstart, dwbuf.buf, dav++);
+		if (error != 0)
+			return error;
+	}
+
+	return 0;
+}
+
+/*
+ * Read the header of the next DIE of a unit, skipping the null entries
+ * closing lists of children.  ``die_dab'' is NULL at the end of the unit.
+ */
+static int
+dw_die_header(struct dwbuf *dwbuf, struct dwcu *dcu, struct dwdie *die)
+{
+	uint64_t	 code;
+
+	die->die_dab = NULL;
+
+	while (dwbuf->len > 0) {
+		die->die_offset = dcu->dcu_nextoff - dwbuf->len;
+		if (dw_read_uleb128(dwbuf, &code))
+			return -1;
+
+		if (code == 0) {
+			dcu->dcu_lvl--;
+			continue;
+		}
+
+		die->die_dab = dw_ab_lookup(dcu->dcu_abtab, code);
+		if (die->die_dab == NULL)
+			return ESRCH;
+
+		die->die_lvl = dcu->dcu_lvl;
+		break;
+	}
+
+	return 0;
+}
+
+/* Decode the values of a DIE, or skip them if the unit is lazy. */
+static int
+dw_die_values(struct dwbuf *dwbuf, struct dwcu *dcu, struct dwdie *die,
+    struct dwaval *avals)
+{
+	struct dwabbrev	*dab = die->die_dab;
+	const char	*start = dwbuf->buf;
+	int		 error;
+
+	if (dcu->dcu_flags & DW_CU_LAZY)
+		error = dw_die_skip(dwbuf, dab, dcu->dcu_psize,
+		    dw_decoders[DWCU_MSB(dcu)]);
+	else {
+		error = dw_parsers[DWCU_MSB(dcu)](dwbuf, dab, dcu->dcu_psize,
+		    avals);
+		if (error == 0 && dcu->dcu_relocs != NULL)
+			error = dw_die_reloc(dcu, start, dwbuf->buf, dab,
+			    avals);
+	}
+
+	if (error == 0 && dab->dab_children == DW_CHILDREN_yes)
+		dcu->dcu_lvl++;
+
+	return error;
+}
+
+/*
+ * Double the size of an array of ``*nelemp'' elements of ``elsz'' bytes.
+ * The arrays of a parsed unit are not carved from its arena, a copy
+ * left behind by each growth would only be released by the next reset.
+ */
+static void *
+dw_die_grow(void *p, size_t *nelemp, size_t elsz)
+{
+	size_t		 n;
+
+	n = (*nelemp == 0) ? 64 : *nelemp * 2;
+	p = reallocarray(p, n, elsz);
+	if (p != NULL)
+		*nelemp = n;
+
+	return p;
+}
+
+static int
+dw_die_parse(struct dwbuf *dwbuf, struct dwcu *dcu)
+{
+	struct dwdie	*die;
+	void		*p;
+	int		 lazy = (dcu->dcu_flags & DW_CU_LAZY);
+	size_t		 nattrs, ndiemax = 0, navalmax = 0;
+	int		 error;
+
+	for (;;) {
+		if (dcu->dcu_ndies == ndiemax) {
+			p = dw_die_grow(dcu->dcu_dies, &ndiemax, sizeof(*die));
+			if (p == NULL)
+				return ENOMEM;
+			dcu->dcu_dies = p;
+		}
+
+		die = &dcu->dcu_dies[dcu->dcu_ndies];
+		error = dw_die_header(dwbuf, dcu, die);
+		if (error != 0)
+			return error;
+		if (die->die_dab == NULL)
+			break;
+
+		nattrs = lazy ? 0 : die->die_dab->dab_nattrs;
+		while (dcu->dcu_navals + nattrs > navalmax) {
+			p = dw_die_grow(dcu->dcu_avals, &navalmax,
+			    sizeof(struct dwaval));
+			if (p == NULL)
+				return ENOMEM;
+			dcu->dcu_avals = p;
+		}
+
+		die->die_aval = dcu->dcu_navals;
+		error = dw_die_values(dwbuf, dcu, die,
+		    &dcu->dcu_avals[dcu->dcu_navals]);
+		if (error != 0)
+			return error;
+
+		dcu->dcu_navals += nattrs;
+		dcu->dcu_ndies++;
+	}
+
+	return 0;
+}
+
+int
+dw_ab_parse(struct dwbuf *abseg, struct dwarena *dar, struct dwabtab *dbt)
+{
+	struct dwabbrev_queue *dabq = &dbt->dbt_abbrevs;
+	struct dwabbrev	*dab;
+	uint64_t	 code, tag;
+	uint8_t		 children;
+
+	if (abseg->len == 0)
+		return EINVAL;
 
 	for (;;) {
 		if (dw_read_uleb128(abseg, &code) || (code == 0))
@@ -470,13 +1279,14 @@ dw_ab_parse(struct dwbuf *abseg, struct dwabbrev_queue *dabq)
 		    dw_read_u8(abseg, &children))
 			return -1;
 
-		dab = malloc(sizeof(*dab));
+		dab = dw_arena_alloc(dar, sizeof(*dab));
 		if (dab == NULL)
 			return ENOMEM;
 
 		dab->dab_code = code;
 		dab->dab_tag = tag;
 		dab->dab_children = children;
+		dab->dab_nattrs = 0;
 		SIMPLEQ_INIT(&dab->dab_attrs);
 
 		SIMPLEQ_INSERT_TAIL(dabq, dab, dab_next);
@@ -492,7 +1302,7 @@ dw_ab_parse(struct dwbuf *abseg, struct dwabbrev_queue *dabq)
 			if ((attr == 0) && (form == 0))
 				break;
 
-			dat = malloc(sizeof(*dat));
+			dat = dw_arena_alloc(dar, sizeof(*dat));
 			if (dat == NULL)
 				return ENOMEM;
 
@@ -500,40 +1310,431 @@ dw_ab_parse(struct dwbuf *abseg, struct dwabbrev_queue *dabq)
 			dat->dat_form = form;
 
 			SIMPLEQ_INSERT_TAIL(&dab->dab_attrs, dat, dat_next);
+			dab->dab_nattrs++;
+		}
+
+		if (dw_ab_plan(dab, dar))
+			return ENOMEM;
+	}
+
+	return dw_ab_index(dbt, dar);
+}
+
+/*
+ * Compile the list of attributes of an abbreviation into the opcodes of
+ * the decoders of their values, and compute the plan to skip them.
+ * Consecutive values of fixed size are merged in a single step, and
+ * since the size of addresses depends on the Compile Unit they are
+ * counted separately.  An abbreviation using only fixed size forms
+ * ends up with a single step.
+ *
+ * Also compute the maximum size of the values preceding the first one
+ * whose size is not bounded, a string or a block, to decode them with
+ * a single bounds check.
+ */
+static int
+dw_ab_plan(struct dwabbrev *dab, struct dwarena *dar)
+{
+	struct dwattr	*dat;
+	struct dwskip	*dsk;
+	size_t		 n = 1;
+	uint8_t		 op;
+	int		 size, bounded = 1;
+
+	SIMPLEQ_FOREACH(dat, &dab->dab_attrs, dat_next) {
+		if (dw_form_size(dat->dat_form, sizeof(uint64_t)) < 0)
+			n++;
+	}
+
+	dab->dab_skips = dw_arena_alloc(dar, n * sizeof(*dab->dab_skips));
+	dab->dab_ops = dw_arena_alloc(dar, dab->dab_nattrs);
+	if (dab->dab_skips == NULL || dab->dab_ops == NULL)
+		return ENOMEM;
+	dab->dab_nskips = n;
+
+	n = 0;
+	dab->dab_nbounded = dab->dab_bound = 0;
+	SIMPLEQ_FOREACH(dat, &dab->dab_attrs, dat_next) {
+		op = dab->dab_ops[n++] = dw_form2op(dat->dat_form);
+		if (!bounded)
+			continue;
+		switch (op) {
+		case DWD_ADDR:
+		case DWD_U64:
+			dab->dab_bound += sizeof(uint64_t);
+			break;
+		case DWD_U32:
+			dab->dab_bound += sizeof(uint32_t);
+			break;
+		case DWD_U16:
+			dab->dab_bound += sizeof(uint16_t);
+			break;
+		case DWD_U8:
+			dab->dab_bound += sizeof(uint8_t);
+			break;
+		case DWD_ULEB128:
+		case DWD_SLEB128:
+			dab->dab_bound += DW_LEB128_MAX;
+			break;
+		case DWD_FLAG_PRESENT:
+			break;
+		default:
+			bounded = 0;
+			continue;
+		}
+		dab->dab_nbounded++;
+	}
+
+	dsk = dab->dab_skips;
+	memset(dsk, 0, sizeof(*dsk));
+	SIMPLEQ_FOREACH(dat, &dab->dab_attrs, dat_next) {
+		switch (dat->dat_form) {
+		case DW_FORM_addr:
+		case DW_FORM_ref_addr:
+			dsk->dsk_naddr++;
+			break;
+		default:
+			size = dw_form_size(dat->dat_form, 0);
+			if (size >= 0) {
+				dsk->dsk_fixed += size;
+				break;
+			}
+			dsk->dsk_form = dat->dat_form;
+			dsk++;
+			memset(dsk, 0, sizeof(*dsk));
+			break;
 		}
 	}
 
 	return 0;
 }
 
-void
-dw_dabq_purge(struct dwabbrev_queue *dabq)
+#define DW_AB_HASH(dbt, code)	((code) & ((dbt)->dbt_nhash - 1))
+
+/*
+ * Build the lookup tables of a parsed abbreviation table.  Codes from
+ * 1 to the number of abbreviations are stored in a directly indexed
+ * array, other ones in an open addressing hash.  Like a linear search
+ * would, the first abbreviation declared with a given code wins.
+ */
+static int
+dw_ab_index(struct dwabtab *dbt, struct dwarena *dar)
 {
 	struct dwabbrev	*dab;
+	size_t		 n = 0, nsparse = 0, h;
+
+	SIMPLEQ_FOREACH(dab, &dbt->dbt_abbrevs, dab_next) {
+		if (dab->dab_nattrs > dbt->dbt_maxattrs)
+			dbt->dbt_maxattrs = dab->dab_nattrs;
+		n++;
+	}
+
+	if (n == 0)
+		return 0;
+
+	dbt->dbt_index = dw_arena_alloc(dar, n * sizeof(*dbt->dbt_index));
+	if (dbt->dbt_index == NULL)
+		return ENOMEM;
+	memset(dbt->dbt_index, 0, n * sizeof(*dbt->dbt_index));
+	dbt->dbt_nindex = n;
+
+	SIMPLEQ_FOREACH(dab, &dbt->dbt_abbrevs, dab_next) {
+		if (dab->dab_code >= 1 && dab->dab_code <= n) {
+			if (dbt->dbt_index[dab->dab_code - 1] == NULL)
+				dbt->dbt_index[dab->dab_code - 1] = dab;
+		} else
+			nsparse++;
+	}
 
-	while ((dab = SIMPLEQ_FIRST(dabq)) != NULL) {
-		struct dwattr *dat;
+	if (nsparse == 0)
+		return 0;
 
-		SIMPLEQ_REMOVE_HEAD(dabq, dab_next);
-		while ((dat = SIMPLEQ_FIRST(&dab->dab_attrs)) != NULL) {
-			SIMPLEQ_REMOVE_HEAD(&dab->dab_attrs, dat_next);
-			free(dat);
+	for (h = 8; h < nsparse * 2; h *= 2)
+		continue;
+
+	dbt->dbt_hash = dw_arena_alloc(dar, h * sizeof(*dbt->dbt_hash));
+	if (dbt->dbt_hash == NULL)
+		return ENOMEM;
+	memset(dbt->dbt_hash, 0, h * sizeof(*dbt->dbt_hash));
+	dbt->dbt_nhash = h;
+
+	SIMPLEQ_FOREACH(dab, &dbt->dbt_abbrevs, dab_next) {
+		if (dab->dab_code >= 1 && dab->dab_code <= n)
+			continue;
+
+		for (h = DW_AB_HASH(dbt, dab->dab_code);
+		    dbt->dbt_hash[h] != NULL; h = DW_AB_HASH(dbt, h + 1)) {
+			if (dbt->dbt_hash[h]->dab_code == dab->dab_code)
+				break;
 		}
+		if (dbt->dbt_hash[h] == NULL)
+			dbt->dbt_hash[h] = dab;
+	}
 
-		free(dab);
+	return 0;
+}
+
+struct dwabbrev *
+dw_ab_lookup(struct dwabtab *dbt, uint64_t code)
+{
+	struct dwabbrev	*dab;
+	size_t		 h;
+
+	if (code >= 1 && code <= dbt->dbt_nindex)
+		return dbt->dbt_index[code - 1];
+
+	if (dbt->dbt_nhash == 0)
+		return NULL;
+
+	for (h = DW_AB_HASH(dbt, code); (dab = dbt->dbt_hash[h]) != NULL;
+	    h = DW_AB_HASH(dbt, h + 1)) {
+		if (dab->dab_code == code)
+			return dab;
+	}
+
+	return NULL;
+}
+
+void
+dw_abtab_init(struct dwabtab *dbt)
+{
+	SIMPLEQ_INIT(&dbt->dbt_abbrevs);
+	dbt->dbt_index = NULL;
+	dbt->dbt_nindex = 0;
+	dbt->dbt_hash = NULL;
+	dbt->dbt_nhash = 0;
+	dbt->dbt_maxattrs = 0;
+}
+
+void
+dw_arena_init(struct dwarena *dar)
+{
+	SLIST_INIT(&dar->dar_chunks);
+	SLIST_INIT(&dar->dar_free);
+}
+
+/*
+ * Get a chunk able to hold ``sz'' bytes.  Regular chunks are taken
+ * from the free list when possible and become the current one, while
+ * big allocations get a dedicated chunk inserted behind the current
+ * one so that its remaining space is not lost.
+ */
+static struct dwchunk *
+dw_arena_chunk(struct dwarena *dar, size_t sz)
+{
+	struct dwchunk	*dch, *cur;
+
+	if (sz > DW_CHUNK_SIZE / 4) {
+		dch = malloc(DW_CHUNK_HDRSZ + sz);
+		if (dch == NULL)
+			return NULL;
+		dch->dch_size = sz;
+		dch->dch_used = 0;
+
+		cur = SLIST_FIRST(&dar->dar_chunks);
+		if (cur != NULL)
+			SLIST_INSERT_AFTER(cur, dch, dch_next);
+		else
+			SLIST_INSERT_HEAD(&dar->dar_chunks, dch, dch_next);
+		return dch;
 	}
 
-	SIMPLEQ_INIT(dabq);
+	dch = SLIST_FIRST(&dar->dar_free);
+	if (dch != NULL) {
+		SLIST_REMOVE_HEAD(&dar->dar_free, dch_next);
+	} else {
+		dch = malloc(DW_CHUNK_HDRSZ + DW_CHUNK_SIZE);
+		if (dch == NULL)
+			return NULL;
+		dch->dch_size = DW_CHUNK_SIZE;
+	}
+	dch->dch_used = 0;
+	SLIST_INSERT_HEAD(&dar->dar_chunks, dch, dch_next);
+
+	return dch;
 }
 
+void *
+dw_arena_alloc(struct dwarena *dar, size_t sz)
+{
+	struct dwchunk	*dch;
+	void		*p;
+
+	sz = DW_ARENA_ROUND(sz);
+
+	dch = SLIST_FIRST(&dar->dar_chunks);
+	if (dch == NULL || dch->dch_size - dch->dch_used < sz) {
+		dch = dw_arena_chunk(dar, sz);
+		if (dch == NULL)
+			return NULL;
+	}
+
+	p = DW_CHUNK_DATA(dch) + dch->dch_used;
+	dch->dch_used += sz;
+
+	return p;
+}
+
+/* Release everything carved from the arena, but keep its chunks. */
+void
+dw_arena_reset(struct dwarena *dar)
+{
+	struct dwchunk	*dch;
+
+	while ((dch = SLIST_FIRST(&dar->dar_chunks)) != NULL) {
+		SLIST_REMOVE_HEAD(&dar->dar_chunks, dch_next);
+		if (dch->dch_size != DW_CHUNK_SIZE) {
+			free(dch);
+			continue;
+		}
+		SLIST_INSERT_HEAD(&dar->dar_free, dch, dch_next);
+	}
+}
+
+void
+dw_arena_purge(struct dwarena *dar)
+{
+	struct dwchunk	*dch;
+
+	dw_arena_reset(dar);
+	while ((dch = SLIST_FIRST(&dar->dar_free)) != NULL) {
+		SLIST_REMOVE_HEAD(&dar->dar_free, dch_next);
+		free(dch);
+	}
+}
+
+void
+dw_abcache_init(struct dwabcache *dac)
+{
+	memset(dac, 0, sizeof(*dac));
+	dw_arena_init(&dac->dac_arena);
+}
+
+void
+dw_abcache_freeze(struct dwabcache *dac)
+{
+	dac->dac_frozen = 1;
+}
+
+void
+dw_abcache_purge(struct dwabcache *dac)
+{
+	dw_arena_purge(&dac->dac_arena);
+	free(dac->dac_buckets);
+	dac->dac_buckets = NULL;
+	dac->dac_nbuckets = 0;
+	dac->dac_nentries = 0;
+}
+
+#define DW_ABCACHE_BUCKET(dac, off)	((off) & ((dac)->dac_nbuckets - 1))
+
+/* Double the number of buckets, rehashing the existing entries. */
+static int
+dw_abcache_grow(struct dwabcache *dac)
+{
+	struct dwabent_list	*buckets, *obuckets = dac->dac_buckets;
+	struct dwabent		*dae;
+	size_t			 i, onbuckets = dac->dac_nbuckets;
+
+	dac->dac_nbuckets = (onbuckets == 0) ? 64 : onbuckets * 2;
+	buckets = calloc(dac->dac_nbuckets, sizeof(*buckets));
+	if (buckets == NULL) {
+		dac->dac_nbuckets = onbuckets;
+		return ENOMEM;
+	}
+
+	for (i = 0; i < dac->dac_nbuckets; i++)
+		SLIST_INIT(&buckets[i]);
+
+	dac->dac_buckets = buckets;
+	for (i = 0; i < onbuckets; i++) {
+		while ((dae = SLIST_FIRST(&obuckets[i])) != NULL) {
+			SLIST_REMOVE_HEAD(&obuckets[i], dae_next);
+			SLIST_INSERT_HEAD(
+			    &buckets[DW_ABCACHE_BUCKET(dac, dae->dae_offset)],
+			    dae, dae_next);
+		}
+	}
+	free(obuckets);
+
+	return 0;
+}
+
+/*
+ * Return the abbreviation table starting at offset ``off'' of the
+ * segment, parsing it only the first time it is requested.  Once the
+ * cache is frozen it is only looked up, and can be shared by several
+ * threads.
+ */
 int
-dw_cu_parse(struct dwbuf *info, struct dwbuf *abbrev, size_t seglen,
-    struct dwcu **dcup)
+dw_abcache_get(struct dwabcache *dac, struct dwbuf *abbrev, uint64_t off,
+    struct dwabtab **dbtp)
 {
 	struct dwbuf	 abseg = *abbrev;
+	struct dwabent	*dae;
+	int		 error;
+
+	if (dac->dac_nbuckets > 0) {
+		SLIST_FOREACH(dae,
+		    &dac->dac_buckets[DW_ABCACHE_BUCKET(dac, off)], dae_next) {
+			if (dae->dae_offset == off) {
+				if (!dac->dac_frozen)
+					dac->dac_hits++;
+				*dbtp = &dae->dae_abtab;
+				return 0;
+			}
+		}
+	}
+
+	if (dac->dac_frozen)
+		return ENOENT;
+
+	dac->dac_misses++;
+
+	if (dw_skip_bytes(&abseg, off))
+		return -1;
+
+	if (dac->dac_nentries >= dac->dac_nbuckets * 2) {
+		error = dw_abcache_grow(dac);
+		if (error != 0)
+			return error;
+	}
+
+	dae = dw_arena_alloc(&dac->dac_arena, sizeof(*dae));
+	if (dae == NULL)
+		return ENOMEM;
+
+	dae->dae_offset = off;
+	dw_abtab_init(&dae->dae_abtab);
+
+	/* On error the partial table stays in the arena until purged. */
+	error = dw_ab_parse(&abseg, &dac->dac_arena, &dae->dae_abtab);
+	if (error != 0)
+		return error;
+
+	SLIST_INSERT_HEAD(&dac->dac_buckets[DW_ABCACHE_BUCKET(dac, off)], dae,
+	    dae_next);
+	dac->dac_nentries++;
+	*dbtp = &dae->dae_abtab;
+
+	return 0;
+}
+
+/*
+ * Parse the header of the Compile Unit at the beginning of ``info'' and
+ * get its abbreviation table.
+ */
+static int
+dw_cu_header(struct dwbuf *info, struct dwbuf *abbrev, size_t seglen,
+    const struct dwrelocs *drs, struct dwabcache *dac, struct dwarena *dar,
+    int flags, struct dwcu **dcup)
+{
 	struct dwbuf	 dwbuf;
+	const char	*seg, *abbrp;
 	size_t		 segoff, nextoff, addrsize;
 	struct dwcu	*dcu = NULL;
+	const dwdec_fn	*decoders = dw_decoders[(flags & DW_CU_MSB) != 0];
+	struct dwaval	 dav;
 	uint32_t	 length = 0, abbroff = 0;
 	uint16_t	 version;
 	uint8_t		 psz;
@@ -544,9 +1745,11 @@ dw_cu_parse(struct dwbuf *info, struct dwbuf *abbrev, size_t seglen,
 
 	/* Offset in the segment of the current Compile Unit. */
 	segoff = seglen - info->len;
+	seg = info->buf - segoff;
 
-	if (dw_read_u32(info, &length))
+	if (decoders[DWD_U32](info, 0, &dav))
 		return -1;
+	length = dav.dav_u32;
 
 	if (length >= 0xfffffff0 || length > info->len)
 		return EOVERFLOW;
@@ -559,38 +1762,85 @@ dw_cu_parse(struct dwbuf *info, struct dwbuf *abbrev, size_t seglen,
 
 	addrsize = 4; /* XXX */
 
-	if (dw_read_u16(&dwbuf, &version) ||
-	    dw_read_bytes(&dwbuf, &abbroff, addrsize) ||
-	    dw_read_u8(&dwbuf, &psz))
+	if (decoders[DWD_U16](&dwbuf, 0, &dav))
 		return -1;
+	version = dav.dav_u16;
 
-	if (dw_skip_bytes(&abseg, abbroff))
+	abbrp = dwbuf.buf;
+	if (decoders[DWD_U32](&dwbuf, 0, &dav))
+		return -1;
+	abbroff = dav.dav_u32;
+	if (decoders[DWD_U8](&dwbuf, 0, &dav))
+		return -1;
+	psz = dav.dav_u8;
+
+	if (drs != NULL)
+		abbroff = dw_reloc_field(drs, abbrp - seg, addrsize, abbroff);
+
+	if (abbroff > abbrev->len)
 		return -1;
 
 	/* Only DWARF2 until extended. */
 	if (version != 2)
 		return ENOTSUP;
 
-	dcu = malloc(sizeof(*dcu));
-	if (dcu == NULL)
+	dcu = dw_arena_alloc(dar, sizeof(*dcu));
+	if (dcu == NULL) {
+		dw_arena_reset(dar);
 		return ENOMEM;
+	}
 
+	dcu->dcu_seg = info->buf - nextoff;
+	dcu->dcu_nextoff = nextoff;
+	dcu->dcu_cur = dwbuf;
+	dcu->dcu_lvl = 0;
+	dcu->dcu_flags = flags;
 	dcu->dcu_offset = segoff;
 	dcu->dcu_length = length;
 	dcu->dcu_version = version;
 	dcu->dcu_abbroff = abbroff;
 	dcu->dcu_psize = psz;
-	SIMPLEQ_INIT(&dcu->dcu_abbrevs);
-	SIMPLEQ_INIT(&dcu->dcu_dies);
-
-	error = dw_ab_parse(&abseg, &dcu->dcu_abbrevs);
+	dcu->dcu_abtab = NULL;
+	dcu->dcu_arena = dar;
+	dw_arena_init(&dcu->dcu_scratch);
+	dcu->dcu_relocs = drs;
+	dcu->dcu_nextreloc = 0;
+	dcu->dcu_dies = NULL;
+	dcu->dcu_ndies = 0;
+	dcu->dcu_avals = NULL;
+	dcu->dcu_navals = 0;
+
+	error = dw_abcache_get(dac, abbrev, abbroff, &dcu->dcu_abtab);
 	if (error != 0) {
 		dw_dcu_free(dcu);
 		return error;
 	}
 
-	error = dw_die_parse(&dwbuf, nextoff, psz, &dcu->dcu_abbrevs,
-	    &dcu->dcu_dies);
+	*dcup = dcu;
+	return 0;
+}
+
+/*
+ * Parse the Compile Unit at the beginning of ``info''.  With DW_CU_LAZY
+ * only the DIE headers are recorded and values are decoded on demand,
+ * from the segment, by dw_die_getattr().  If ``drs'' is not NULL, its
+ * relocations have not been applied to the segment and are resolved
+ * when the relocated values are read.
+ */
+int
+dw_cu_parse(struct dwbuf *info, struct dwbuf *abbrev, size_t seglen,
+    const struct dwrelocs *drs, struct dwabcache *dac, struct dwarena *dar,
+    int flags, struct dwcu **dcup)
+{
+	struct dwcu	*dcu;
+	int		 error;
+
+	error = dw_cu_header(info, abbrev, seglen, drs, dac, dar,
+	    flags & ~DW_CU_WALK, &dcu);
+	if (error != 0)
+		return error;
+
+	error = dw_die_parse(&dcu->dcu_cur, dcu);
 	if (error != 0) {
 		dw_dcu_free(dcu);
 		return error;
@@ -604,15 +1854,324 @@ dw_cu_parse(struct dwbuf *info, struct dwbuf *abbrev, size_t seglen,
 	return 0;
 }
 
+/*
+ * Like dw_cu_parse() but without reading any DIE.  They are returned
+ * one at a time, straight from the segment, by dw_die_next().  A unit
+ * being walked holds a single DIE and its values, so the memory used
+ * does not depend on its size.
+ */
+int
+dw_cu_walk(struct dwbuf *info, struct dwbuf *abbrev, size_t seglen,
+    const struct dwrelocs *drs, struct dwabcache *dac, struct dwarena *dar,
+    int flags, struct dwcu **dcup)
+{
+	struct dwcu	*dcu;
+	size_t		 maxattrs;
+	int		 error;
+
+	error = dw_cu_header(info, abbrev, seglen, drs, dac, dar,
+	    flags | DW_CU_WALK, &dcu);
+	if (error != 0)
+		return error;
+
+	maxattrs = dcu->dcu_abtab->dbt_maxattrs;
+	dcu->dcu_dies = dw_arena_alloc(dar, sizeof(*dcu->dcu_dies));
+	dcu->dcu_avals = dw_arena_alloc(dar,
+	    maxattrs * sizeof(*dcu->dcu_avals));
+	if (dcu->dcu_dies == NULL || dcu->dcu_avals == NULL) {
+		dw_dcu_free(dcu);
+		return ENOMEM;
+	}
+
+	*dcup = dcu;
+	return 0;
+}
+
+void
+dw_cutab_init(struct dwcutab *dct)
+{
+	memset(dct, 0, sizeof(*dct));
+}
+
+void
+dw_cutab_purge(struct dwcutab *dct)
+{
+	free(dct->dct_units);
+	dw_cutab_init(dct);
+}
+
+/*
+ * Record the header of every unit of the segment ``info'', hopping from
+ * one to the next using their length, without parsing any DIE.  If a
+ * header is invalid, the units before it are kept in the table.
+ */
+int
+dw_cutab_scan(struct dwbuf *info, const struct dwrelocs *drs, int flags,
+    struct dwcutab *dct)
+{
+	struct dwbuf	 dwbuf = *info;
+	struct dwcuent	*dce;
+	const char	*abbrp;
+	size_t		 segoff, nunitsmax = dct->dct_nunits;
+	const dwdec_fn	*decoders = dw_decoders[(flags & DW_CU_MSB) != 0];
+	struct dwaval	 dav;
+	uint32_t	 length, abbroff;
+	uint16_t	 version;
+	uint8_t		 psz;
+
+	while (dwbuf.len > 0) {
+		segoff = dwbuf.buf - info->buf;
+		if (decoders[DWD_U32](&dwbuf, 0, &dav))
+			return -1;
+		length = dav.dav_u32;
+		if (length >= 0xfffffff0 || length > dwbuf.len)
+			return EOVERFLOW;
+
+		abbrp = dwbuf.buf + sizeof(version);
+		if (decoders[DWD_U16](&dwbuf, 0, &dav))
+			return -1;
+		version = dav.dav_u16;
+		if (decoders[DWD_U32](&dwbuf, 0, &dav))
+			return -1;
+		abbroff = dav.dav_u32;
+		if (decoders[DWD_U8](&dwbuf, 0, &dav))
+			return -1;
+		psz = dav.dav_u8;
+		if (length < sizeof(version) + sizeof(abbroff) + sizeof(psz))
+			return EOVERFLOW;
+		if (drs != NULL)
+			abbroff = dw_reloc_field(drs, abbrp - info->buf,
+			    sizeof(abbroff), abbroff);
+
+		if (dct->dct_nunits == nunitsmax) {
+			nunitsmax = (nunitsmax == 0) ? 64 : nunitsmax * 2;
+			dce = reallocarray(dct->dct_units, nunitsmax,
+			    sizeof(*dce));
+			if (dce == NULL)
+				return ENOMEM;
+			dct->dct_units = dce;
+		}
+		dce = &dct->dct_units[dct->dct_nunits++];
+		dce->dce_offset = segoff;
+		dce->dce_length = length;
+		dce->dce_abbroff = abbroff;
+		dce->dce_version = version;
+		dce->dce_psize = psz;
+
+		dwbuf.buf = info->buf + segoff + sizeof(length) + length;
+		dwbuf.len = info->len - segoff - sizeof(length) - length;
+	}
+
+	return 0;
+}
+
+/* Find the unit starting at offset ``off'' of the segment. */
+struct dwcuent *
+dw_cutab_find(struct dwcutab *dct, size_t off)
+{
+	size_t		 lo = 0, hi = dct->dct_nunits, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (dct->dct_units[mid].dce_offset < off)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if (lo < dct->dct_nunits && dct->dct_units[lo].dce_offset == off)
+		return &dct->dct_units[lo];
+
+	return NULL;
+}
+
+/*
+ * Return the next DIE of a unit being walked, or NULL at its end.  The
+ * DIE and its values are only valid until the next call.
+ */
+int
+dw_die_next(struct dwcu *dcu, struct dwdie **diep)
+{
+	struct dwdie	*die = dcu->dcu_dies;
+	int		 error;
+
+	if (!(dcu->dcu_flags & DW_CU_WALK))
+		return EINVAL;
+
+	*diep = NULL;
+	dcu->dcu_ndies = 0;
+	dcu->dcu_navals = 0;
+	dw_arena_reset(&dcu->dcu_scratch);
+
+	error = dw_die_header(&dcu->dcu_cur, dcu, die);
+	if (error != 0 || die->die_dab == NULL)
+		return error;
+
+	die->die_aval = 0;
+	error = dw_die_values(&dcu->dcu_cur, dcu, die, dcu->dcu_avals);
+	if (error != 0)
+		return error;
+
+	if (!(dcu->dcu_flags & DW_CU_LAZY))
+		dcu->dcu_navals = die->die_dab->dab_nattrs;
+	dcu->dcu_ndies = 1;
+	*diep = die;
+
+	return 0;
+}
+
+/*
+ * Skip the children of the DIE returned by the last dw_die_next() call.
+ * Jump to its DW_AT_sibling if it has one, otherwise skip DIEs using the
+ * plans of their abbreviation.
+ */
+int
+dw_die_skip_children(struct dwcu *dcu, struct dwdie *die)
+{
+	struct dwbuf	*dwbuf = &dcu->dcu_cur;
+	struct dwabbrev	*dab;
+	struct dwaval	 dav;
+	uint64_t	 code, sib = 0;
+	size_t		 depth;
+	int		 error;
+
+	if (!(dcu->dcu_flags & DW_CU_WALK))
+		return EINVAL;
+
+	if (die->die_dab->dab_children != DW_CHILDREN_yes)
+		return 0;
+
+	if (dw_die_getattr(dcu, die, DW_AT_sibling, &dav) == 0) {
+		switch (dav.dav_dat->dat_form) {
+		case DW_FORM_ref1:
+			sib = dav.dav_u8;
+			break;
+		case DW_FORM_ref2:
+			sib = dav.dav_u16;
+			break;
+		case DW_FORM_ref4:
+			sib = dav.dav_u32;
+			break;
+		case DW_FORM_ref8:
+		case DW_FORM_ref_udata:
+			sib = dav.dav_u64;
+			break;
+		}
+		sib += dcu->dcu_offset;
+	}
+
+	if (sib > die->die_offset && sib <= dcu->dcu_nextoff) {
+		dwbuf->buf = dcu->dcu_seg + sib;
+		dwbuf->len = dcu->dcu_nextoff - sib;
+		dcu->dcu_lvl = die->die_lvl;
+		return 0;
+	}
+
+	/* Depth relative to ``die'', wider than the 8-bit levels. */
+	for (depth = 1; depth > 0;) {
+		if (dw_read_uleb128(dwbuf, &code))
+			return -1;
+
+		if (code == 0) {
+			depth--;
+			continue;
+		}
+
+		dab = dw_ab_lookup(dcu->dcu_abtab, code);
+		if (dab == NULL)
+			return ESRCH;
+
+		error = dw_die_skip(dwbuf, dab, dcu->dcu_psize,
+		    dw_decoders[DWCU_MSB(dcu)]);
+		if (error != 0)
+			return error;
+
+		if (dab->dab_children == DW_CHILDREN_yes)
+			depth++;
+	}
+	dcu->dcu_lvl = die->die_lvl;
+
+	return 0;
+}
+
+/*
+ * Continue the walk of a unit at the DIE at offset ``off'' of the
+ * segment, found with dw_die_skip_children() at level ``lvl''.
+ */
+int
+dw_die_seek(struct dwcu *dcu, size_t off, uint8_t lvl)
+{
+	if (!(dcu->dcu_flags & DW_CU_WALK))
+		return EINVAL;
+
+	if (off < dcu->dcu_offset || off > dcu->dcu_nextoff)
+		return EINVAL;
+
+	dcu->dcu_cur.buf = dcu->dcu_seg + off;
+	dcu->dcu_cur.len = dcu->dcu_nextoff - off;
+	dcu->dcu_lvl = lvl;
+
+	return 0;
+}
+
+/* Get the value of the attribute ``attr'' of a DIE. */
+int
+dw_die_getattr(struct dwcu *dcu, struct dwdie *die, uint64_t attr,
+    struct dwaval *dav)
+{
+	struct dwbuf	 dwbuf;
+	struct dwattr	*dat;
+	const char	*start;
+	uint64_t	 code;
+	size_t		 i = 0;
+	int		 error;
+
+	if (!(dcu->dcu_flags & DW_CU_LAZY)) {
+		SIMPLEQ_FOREACH(dat, &die->die_dab->dab_attrs, dat_next) {
+			if (dat->dat_attr == attr) {
+				*dav = DWCU_AVALS(dcu, die)[i];
+				return 0;
+			}
+			i++;
+		}
+		return ENOENT;
+	}
+
+	dwbuf.buf = dcu->dcu_seg + die->die_offset;
+	dwbuf.len = dcu->dcu_nextoff - die->die_offset;
+
+	if (dw_read_uleb128(&dwbuf, &code))
+		return -1;
+
+	SIMPLEQ_FOREACH(dat, &die->die_dab->dab_attrs, dat_next) {
+		start = dwbuf.buf;
+		error = dw_attr_parse(&dwbuf, dat, dcu->dcu_psize,
+		    DWCU_MSB(dcu), dav);
+		if (error != 0)
+			return error;
+		if (dat->dat_attr != attr)
+			continue;
+		if (dcu->dcu_relocs != NULL)
+			return dw_aval_reloc(dcu, start, dwbuf.buf, dav);
+		return 0;
+	}
+
+	return ENOENT;
+}
+
 void
 dw_dcu_free(struct dwcu *dcu)
 {
 	if (dcu == NULL)
 		return;
 
-	dw_die_purge(&dcu->dcu_dies);
-	dw_dabq_purge(&dcu->dcu_abbrevs);
-	free(dcu);
+	/* Units being walked carve their single DIE from the arena. */
+	if (!(dcu->dcu_flags & DW_CU_WALK)) {
+		free(dcu->dcu_dies);
+		free(dcu->dcu_avals);
+	}
+	dw_arena_purge(&dcu->dcu_scratch);
+	dw_arena_reset(dcu->dcu_arena);
 }
 
 int
@@ -22,6 +22,33 @@ struct dwbuf {
 	size_t			 len;
 };
 
+struct dwchunk;
+
+/*
+ * Relocation of a segment that has not been applied to it, resolved
+ * when the relocated field is read.
+ */
+struct dwreloc {
+	uint64_t		 drl_offset;	/* in the segment */
+	uint64_t		 drl_value;
+	uint8_t			 drl_size;
+};
+
+struct dwrelocs {
+	const struct dwreloc	*drs_relocs;	/* sorted by offset */
+	size_t			 drs_nrelocs;
+};
+
+/*
+ * Bump allocator.  Everything carved from an arena is released at once
+ * and its chunks are kept to be reused, by the next Compile Unit for
+ * example.
+ */
+struct dwarena {
+	SLIST_HEAD(, dwchunk)	 dar_chunks;	/* in use, current first */
+	SLIST_HEAD(, dwchunk)	 dar_free;	/* released, reusable */
+};
+
 struct dwattr {
 	SIMPLEQ_ENTRY(dwattr)	 dat_next;
 	uint64_t		 dat_attr;
@@ -29,7 +56,6 @@ struct dwattr {
 };
 
 struct dwaval {
-	SIMPLEQ_ENTRY(dwaval)	 dav_next;
 	struct dwattr		*dav_dat;	/* corresponding attribute */
 	union {
 		struct dwbuf	 _buf;
@@ -53,38 +79,127 @@ struct dwaval {
 #define dav_u8	AV._V._T._u8
 };
 
-SIMPLEQ_HEAD(dwaval_queue, dwaval);
-
+/*
+ * The values of a DIE are stored contiguously in its Compile Unit's
+ * array, starting at index ``die_aval'', one per attribute of its
+ * abbreviation.  Units parsed lazily have no value array, use
+ * dw_die_getattr() to decode a given attribute.
+ */
 struct dwdie {
-	SIMPLEQ_ENTRY(dwdie)	 die_next;
-	struct dwabbrev		*die_dab;
 	size_t			 die_offset;
+	struct dwabbrev		*die_dab;
+	size_t			 die_aval;	/* index of the first value */
 	uint8_t			 die_lvl;
-	struct dwaval_queue	 die_avals;
 };
 
-SIMPLEQ_HEAD(dwdie_queue, dwdie);
+/*
+ * Step of the plan used to skip the values of a DIE: first skip a fixed
+ * number of bytes and addresses, then a value of variable size of form
+ * ``dsk_form'' unless the step is the last one.
+ */
+struct dwskip {
+	size_t			 dsk_fixed;
+	size_t			 dsk_naddr;
+	uint64_t		 dsk_form;
+};
 
 struct dwabbrev {
 	SIMPLEQ_ENTRY(dwabbrev)	 dab_next;
 	uint64_t		 dab_code;
 	uint64_t		 dab_tag;
 	uint8_t			 dab_children;
+	size_t			 dab_nattrs;
+	uint8_t			*dab_ops;	/* decoder of each value */
+	size_t			 dab_nbounded;	/* leading values of bounded size */
+	size_t			 dab_bound;	/* maximum size of those */
+	struct dwskip		*dab_skips;	/* last one has no form */
+	size_t			 dab_nskips;
 	SIMPLEQ_HEAD(, dwattr)	 dab_attrs;
 };
 
 SIMPLEQ_HEAD(dwabbrev_queue, dwabbrev);
 
+/*
+ * Parsed abbreviation table.  Codes are generally allocated densely
+ * starting at 1, so they are directly indexed, the others are hashed.
+ */
+struct dwabtab {
+	struct dwabbrev_queue	 dbt_abbrevs;
+	struct dwabbrev		**dbt_index;	/* codes 1 to dbt_nindex */
+	size_t			 dbt_nindex;
+	struct dwabbrev		**dbt_hash;	/* sparse codes */
+	size_t			 dbt_nhash;
+	size_t			 dbt_maxattrs;	/* of a single abbreviation */
+};
+
+/*
+ * Abbreviation tables are shared by many Compile Units, keep the ones
+ * already parsed around, indexed by their offset in the segment.
+ */
+struct dwabent {
+	SLIST_ENTRY(dwabent)	 dae_next;
+	uint64_t		 dae_offset;
+	struct dwabtab		 dae_abtab;
+};
+
+SLIST_HEAD(dwabent_list, dwabent);
+
+struct dwabcache {
+	struct dwarena		 dac_arena;	/* tables and entries */
+	struct dwabent_list	*dac_buckets;
+	size_t			 dac_nbuckets;
+	size_t			 dac_nentries;
+	uint64_t		 dac_hits;
+	uint64_t		 dac_misses;
+	int			 dac_frozen;	/* lookups only */
+};
+
 struct dwcu {
+	const char		*dcu_seg;	/* start of the segment */
+	size_t			 dcu_nextoff;	/* offset of the next unit */
+	struct dwbuf		 dcu_cur;	/* DIEs left to read */
+	uint8_t			 dcu_lvl;
+	int			 dcu_flags;
 	uint64_t		 dcu_length;
 	uint64_t		 dcu_abbroff;
 	uint16_t		 dcu_version;
 	uint8_t			 dcu_psize;
 	size_t			 dcu_offset;	/* offset in the segment */
-	struct dwabbrev_queue	 dcu_abbrevs;
-	struct dwdie_queue	 dcu_dies;
+	struct dwabtab		*dcu_abtab;	/* owned by the cache */
+	struct dwarena		*dcu_arena;	/* unit and walked DIE */
+	struct dwarena		 dcu_scratch;	/* copies of the walked DIE */
+	const struct dwrelocs	*dcu_relocs;	/* not applied, or NULL */
+	size_t			 dcu_nextreloc;	/* after the last DIE read */
+	struct dwdie		*dcu_dies;	/* in section order */
+	size_t			 dcu_ndies;
+	struct dwaval		*dcu_avals;
+	size_t			 dcu_navals;
 };
 
+/*
+ * Headers of the units of a segment, found without parsing their DIEs,
+ * to reach any of them directly.
+ */
+struct dwcuent {
+	size_t			 dce_offset;	/* in the segment */
+	uint64_t		 dce_length;
+	uint64_t		 dce_abbroff;
+	uint16_t		 dce_version;
+	uint8_t			 dce_psize;
+};
+
+struct dwcutab {
+	struct dwcuent		*dct_units;	/* in section order */
+	size_t			 dct_nunits;
+};
+
+#define DW_CU_LAZY	0x01	/* only record DIE headers */
+#define DW_CU_WALK	0x02	/* set by dw_cu_walk() */
+#define DW_CU_MSB	0x04	/* big-endian segment */
+
+#define DWCU_AVALS(dcu, die)	(&(dcu)->dcu_avals[(die)->die_aval])
+#define DWCU_MSB(dcu)		(((dcu)->dcu_flags & DW_CU_MSB) != 0)
+
 const char	*dw_tag2name(uint64_t);
 const char	*dw_at2name(uint64_t);
 const char	*dw_form2name(uint64_t);
@@ -92,11 +207,39 @@ const char	*dw_op2name(uint8_t);
 
 int	 dw_loc_parse(struct dwbuf *, uint8_t *, uint64_t *, uint64_t *);
 
-int	 dw_ab_parse(struct dwbuf *, struct dwabbrev_queue *);
-int	 dw_cu_parse(struct dwbuf *, struct dwbuf *, size_t, struct dwcu **);
-
-void	 dw_dabq_purge(struct dwabbrev_queue *);
+int	 dw_ab_parse(struct dwbuf *, struct dwarena *, struct dwabtab *);
+struct dwabbrev	*dw_ab_lookup(struct dwabtab *, uint64_t);
+int	 dw_cu_parse(struct dwbuf *, struct dwbuf *, size_t,
+	     const struct dwrelocs *, struct dwabcache *, struct dwarena *,
+	     int, struct dwcu **);
+int	 dw_cu_walk(struct dwbuf *, struct dwbuf *, size_t,
+	     const struct dwrelocs *, struct dwabcache *, struct dwarena *,
+	     int, struct dwcu **);
+int	 dw_cutab_scan(struct dwbuf *, const struct dwrelocs *, int,
+	     struct dwcutab *);
+struct dwcuent	*dw_cutab_find(struct dwcutab *, size_t);
+int	 dw_die_next(struct dwcu *, struct dwdie **);
+int	 dw_die_skip_children(struct dwcu *, struct dwdie *);
+int	 dw_die_seek(struct dwcu *, size_t, uint8_t);
+int	 dw_die_getattr(struct dwcu *, struct dwdie *, uint64_t,
+	     struct dwaval *);
+
+void	 dw_abtab_init(struct dwabtab *);
 void	 dw_dcu_free(struct dwcu *);
 
+void	 dw_arena_init(struct dwarena *);
+void	*dw_arena_alloc(struct dwarena *, size_t);
+void	 dw_arena_reset(struct dwarena *);
+void	 dw_arena_purge(struct dwarena *);
+
+void	 dw_abcache_init(struct dwabcache *);
+int	 dw_abcache_get(struct dwabcache *, struct dwbuf *, uint64_t,
+	     struct dwabtab **);
+void	 dw_abcache_freeze(struct dwabcache *);
+void	 dw_abcache_purge(struct dwabcache *);
+
+void	 dw_cutab_init(struct dwcutab *);
+void	 dw_cutab_purge(struct dwcutab *);
+
 
 #endif /* _DW_H_ */
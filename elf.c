@@ -14,72 +14,448 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+/*
+ * This file is not compiled on its own but included by elf32.c and
+ * elf64.c, once per ELFSIZE, and its entry points are exported through
+ * elf32_ops and elf64_ops.  Files of both byte orders are supported,
+ * fields are converted when they are read.
+ */
+
 #include <sys/types.h>
 #include <sys/exec_elf.h>
-
-#include <machine/reloc.h>
+#include <sys/mman.h>
+#include <sys/queue.h>
 
 #include <assert.h>
+#include <endian.h>
 #include <err.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+
+#include "dw.h"
+#include "elfuncs.h"
+
+/*
+ * Sections of a file, hashed by name.  The section header table is
+ * only scanned once, when the index is built, to find the sections,
+ * the symbol table and the relocation sections applying to each
+ * section.
+ *
+ * The file is never mapped as a whole, only the ranges that are read:
+ * the section header table while the index is built, the section names
+ * and, when they are looked up, the sections themselves with their
+ * relocations and the symbol table.  Mappings are read-only, so sections
+ * with relocations are copied and relocated in a private buffer the
+ * first time they are looked up.  Other sections are used in place.
+ * Alternatively, the relocations of a section can be resolved and
+ * sorted, to be looked up by the DWARF reader, leaving the section
+ * untouched.
+ */
+struct elfmap {
+	void			*em_addr;
+	size_t			 em_len;
+	int			 em_mapped;	/* or read in a buffer */
+	SLIST_ENTRY(elfmap)	 em_next;
+};
+
+struct elfrel {
+	Elf_Shdr	 er_sh;		/* in host byte order */
+	const char	*er_data;	/* NULL until mapped */
+	struct elfrel	*er_next;
+};
+
+struct elfsec {
+	const char	*es_name;	/* NULL if the slot is free */
+	const char	*es_data;	/* NULL until mapped, or es_copy */
+	off_t		 es_offset;
+	size_t		 es_size;
+	ssize_t		 es_idx;
+	struct elfrel	*es_rels;	/* not yet applied */
+	char		*es_copy;	/* relocated copy */
+	struct dwreloc	*es_lazy;	/* resolved, sorted by offset */
+	size_t		 es_nlazy;
+	int		 es_error;	/* cannot be mapped or relocated */
+};
+
+struct elfsecidx {
+	int		 esi_fd;
+	off_t		 esi_base;	/* offset of the image in the file */
+	size_t		 esi_pagesz;
+	SLIST_HEAD(, elfmap) esi_maps;
+	int		 esi_msb;	/* big-endian file */
+	uint16_t	 esi_machine;
+	int		 esi_badrels;	/* unsupported types reported */
+	struct elfsec	*esi_secs;
+	size_t		 esi_nsecs;	/* power of 2 */
+	struct elfrel	*esi_rels;
+	Elf_Shdr	 esi_symsh;
+	const Elf_Sym	*esi_symtab;	/* NULL until mapped */
+	size_t		 esi_nsymb;
+};
+
+/* Absolute relocations, the only ones found in debug sections. */
+#ifndef R_386_32
+#define R_386_32		1
+#endif
+#ifndef R_X86_64_64
+#define R_X86_64_64		1
+#endif
+#ifndef R_X86_64_32
+#define R_X86_64_32		10
+#endif
+#ifndef R_ARM_ABS32
+#define R_ARM_ABS32		2
+#endif
+#ifndef R_AARCH64_ABS64
+#define R_AARCH64_ABS64		257
+#endif
+#ifndef R_AARCH64_ABS32
+#define R_AARCH64_ABS32		258
+#endif
+#ifndef R_SPARC_32
+#define R_SPARC_32		3
+#endif
+#ifndef R_SPARC_UA32
+#define R_SPARC_UA32		23
+#endif
+#ifndef R_SPARC_64
+#define R_SPARC_64		32
+#endif
+#ifndef R_SPARC_UA64
+#define R_SPARC_UA64		54
+#endif
+#ifndef R_PPC_ADDR32
+#define R_PPC_ADDR32		1
+#endif
+#ifndef R_PPC64_ADDR32
+#define R_PPC64_ADDR32		1
+#endif
+#ifndef R_PPC64_ADDR64
+#define R_PPC64_ADDR64		38
+#endif
+#ifndef R_MIPS_32
+#define R_MIPS_32		2
+#endif
+#ifndef R_MIPS_64
+#define R_MIPS_64		18
+#endif
+#ifndef R_RISCV_32
+#define R_RISCV_32		1
+#endif
+#ifndef R_RISCV_64
+#define R_RISCV_64		2
+#endif
+#ifndef EM_RISCV
+#define EM_RISCV		243
+#endif
+
+static int	iself(const char *, size_t);
+static struct elfsecidx *elf_secidx_create(const char *, int, off_t,
+		    size_t);
+static void	elf_secidx_free(struct elfsecidx *);
+static ssize_t	elf_getsection(struct elfsecidx *, const char *,
+		    const char **, size_t *);
+static ssize_t	elf_getsection_lazy(struct elfsecidx *, const char *,
+		    const char **, size_t *, struct dwrelocs *);
+static void	elf_advise(struct elfsecidx *, const char *, size_t, int);
+static ssize_t	elf_getsecrange(struct elfsecidx *, const char *, off_t *,
+		    size_t *);
+
+static const char *elf_map(struct elfsecidx *, off_t, size_t);
+static void	elf_unmap(struct elfsecidx *, const char *);
+static void	elf_getehdr(const char *, Elf_Ehdr *);
+static void	elf_getshdr(const char *, const Elf_Ehdr *, int, size_t,
+		    Elf_Shdr *);
+static int	elf_getshstab(const char *, size_t, const Elf_Ehdr *, int,
+		    Elf_Shdr *);
+static unsigned long elf_hash(const char *);
+static int	elf_reloc_size(uint16_t, unsigned long);
+static struct elfsec *elf_secfind(struct elfsecidx *, const char *);
+static int	elf_reloc_cmp(const void *, const void *);
+static int	elf_reloc_resolve(struct elfsecidx *, struct elfsec *);
+static void	elf_reloc_unsupported(struct elfsecidx *, struct elfsec *,
+		    size_t);
+static size_t	elf_reloc_range(const struct elfsecidx *,
+		    const struct elfrel *, char *, size_t, size_t, size_t);
+static size_t	elf_reloc_count(const Elf_Shdr *);
+static int	elf_reloc_disjoint(const struct elfsecidx *,
+		    const struct elfrel *);
+static void	*elf_reloc_worker(void *);
+static size_t	elf_reloc_parallel(const struct elfsecidx *,
+		    const struct elfrel *, char *, size_t, size_t);
+static int	elf_reloc_apply(struct elfsecidx *, struct elfsec *);
+static int	elf_secload(struct elfsecidx *, struct elfsec *);
+static int	elf_relload(struct elfsecidx *, struct elfrel *);
+
+const struct elfops ELFNAME(ops) = {
+	.eo_iself		= iself,
+	.eo_secidx_create	= elf_secidx_create,
+	.eo_secidx_free		= elf_secidx_free,
+	.eo_getsection		= elf_getsection,
+	.eo_getsection_lazy	= elf_getsection_lazy,
+	.eo_advise		= elf_advise,
+	.eo_getsecrange		= elf_getsecrange,
+};
+
+/* Convert a field of ``sz'' bytes from the byte order of the file. */
+static inline uint64_t
+elf_get(uint64_t v, size_t sz, const int msb)
+{
+	switch (sz) {
+	case sizeof(uint16_t):
+		return msb ? be16toh((uint16_t)v) : le16toh((uint16_t)v);
+	case sizeof(uint32_t):
+		return msb ? be32toh((uint32_t)v) : le32toh((uint32_t)v);
+	case sizeof(uint64_t):
+		return msb ? be64toh(v) : le64toh(v);
+	default:
+		return v;
+	}
+}
+
+#define ELF_GET(msb, f)	((__typeof__(f))elf_get((f), sizeof(f), (msb)))
+
+/* Implicit addend of a SHT_REL relocation, stored in the field. */
+static inline uint64_t
+elf_reloc_addend(const char *buf, int rsize, const int msb)
+{
+	uint32_t	 v32;
+	uint64_t	 v64;
+
+	if (rsize == 4) {
+		memcpy(&v32, buf, sizeof(v32));
+		return msb ? be32toh(v32) : le32toh(v32);
+	}
+
+	memcpy(&v64, buf, sizeof(v64));
+	return msb ? be64toh(v64) : le64toh(v64);
+}
+
+#define ELF_WRITE_RELOC(buf, val, rsize, msb)				\
+do {									\
+	if (rsize == 4) {						\
+		uint32_t v32 = msb ? htobe32(val) : htole32(val);	\
+		memcpy(buf, &v32, sizeof(v32));				\
+	} else {							\
+		uint64_t v64 = msb ? htobe64(val) : htole64(val);	\
+		memcpy(buf, &v64, sizeof(v64));				\
+	}								\
+} while (0)
+
+/* Copy the file header, in host byte order. */
+static void
+elf_getehdr(const char *p, Elf_Ehdr *eh)
+{
+	int		 msb;
+
+	memcpy(eh, p, sizeof(*eh));
+	msb = (eh->e_ident[EI_DATA] == ELFDATA2MSB);
+
+	eh->e_type = ELF_GET(msb, eh->e_type);
+	eh->e_machine = ELF_GET(msb, eh->e_machine);
+	eh->e_version = ELF_GET(msb, eh->e_version);
+	eh->e_entry = ELF_GET(msb, eh->e_entry);
+	eh->e_phoff = ELF_GET(msb, eh->e_phoff);
+	eh->e_shoff = ELF_GET(msb, eh->e_shoff);
+	eh->e_flags = ELF_GET(msb, eh->e_flags);
+	eh->e_ehsize = ELF_GET(msb, eh->e_ehsize);
+	eh->e_phentsize = ELF_GET(msb, eh->e_phentsize);
+	eh->e_phnum = ELF_GET(msb, eh->e_phnum);
+	eh->e_shentsize = ELF_GET(msb, eh->e_shentsize);
+	eh->e_shnum = ELF_GET(msb, eh->e_shnum);
+	eh->e_shstrndx = ELF_GET(msb, eh->e_shstrndx);
+}
+
+/*
+ * Map ``size'' bytes at offset ``off'' of the image.  Mappings start on
+ * a page boundary, the returned pointer points inside.
+ */
+static const char *
+elf_map(struct elfsecidx *esi, off_t off, size_t size)
+{
+	struct elfmap	*em;
+	off_t		 foff = esi->esi_base + off;
+	size_t		 skew;
+	void		*addr;
+
+	if (size == 0)
+		return "";
+
+	em = malloc(sizeof(*em));
+	if (em == NULL) {
+		warn(NULL);
+		return NULL;
+	}
+
+#ifdef __STRICT_ALIGNMENT
+	/* Members of archives are not aligned, read them instead. */
+	if (foff & (sizeof(uint64_t) - 1)) {
+		addr = malloc(size);
+		if (addr == NULL ||
+		    pread(esi->esi_fd, addr, size, foff) != (ssize_t)size) {
+			warn("pread");
+			free(addr);
+			free(em);
+			return NULL;
+		}
+		em->em_addr = addr;
+		em->em_len = size;
+		em->em_mapped = 0;
+		SLIST_INSERT_HEAD(&esi->esi_maps, em, em_next);
+		return addr;
+	}
+#endif
+
+	skew = foff & (esi->esi_pagesz - 1);
+	addr = mmap(NULL, size + skew, PROT_READ, MAP_SHARED, esi->esi_fd,
+	    foff - skew);
+	if (addr == MAP_FAILED) {
+		warn("mmap");
+		free(em);
+		return NULL;
+	}
+	em->em_addr = addr;
+	em->em_len = size + skew;
+	em->em_mapped = 1;
+	SLIST_INSERT_HEAD(&esi->esi_maps, em, em_next);
+
+	return (char *)addr + skew;
+}
+
+static struct elfmap *
+elf_mapfind(struct elfsecidx *esi, const char *p)
+{
+	struct elfmap	*em;
+
+	SLIST_FOREACH(em, &esi->esi_maps, em_next) {
+		if (p >= (char *)em->em_addr &&
+		    p < (char *)em->em_addr + em->em_len)
+			return em;
+	}
+
+	return NULL;
+}
+
+static void
+elf_unmap(struct elfsecidx *esi, const char *p)
+{
+	struct elfmap	*em;
+
+	em = elf_mapfind(esi, p);
+	if (em == NULL)
+		return;
+
+	SLIST_REMOVE(&esi->esi_maps, em, elfmap, em_next);
+	if (em->em_mapped)
+		munmap(em->em_addr, em->em_len);
+	else
+		free(em->em_addr);
+	free(em);
+}
+
+/*
+ * Give the kernel a hint about how a range of a section returned by
+ * elf_getsection() will be accessed.  Pages of the range released with
+ * MADV_DONTNEED are read again from the file if they are accessed later,
+ * only whole pages are released.  Copies of sections are left alone.
+ */
+static void
+elf_advise(struct elfsecidx *esi, const char *p, size_t len, int advice)
+{
+	struct elfmap	*em;
+	uintptr_t	 start, end, mend;
+
+	em = elf_mapfind(esi, p);
+	if (em == NULL || !em->em_mapped)
+		return;
+
+	mend = (uintptr_t)em->em_addr + em->em_len;
+	start = (uintptr_t)p & ~(esi->esi_pagesz - 1);
+	end = (uintptr_t)p + len;
+	if (end > mend)
+		end = mend;
+	if (advice == MADV_DONTNEED)
+		end &= ~(esi->esi_pagesz - 1);
 
-static int	elf_reloc_size(unsigned long);
-static void	elf_reloc_apply(const char *, const char *, size_t, ssize_t,
-		    char *, size_t);
+	if (end > start)
+		madvise((void *)start, end - start, advice);
+}
+
+/* Copy the header of section ``i'', in host byte order. */
+static void
+elf_getshdr(const char *shtab, const Elf_Ehdr *eh, int msb, size_t i,
+    Elf_Shdr *sh)
+{
+	memcpy(sh, shtab + i * eh->e_shentsize, sizeof(*sh));
+
+	sh->sh_name = ELF_GET(msb, sh->sh_name);
+	sh->sh_type = ELF_GET(msb, sh->sh_type);
+	sh->sh_flags = ELF_GET(msb, sh->sh_flags);
+	sh->sh_addr = ELF_GET(msb, sh->sh_addr);
+	sh->sh_offset = ELF_GET(msb, sh->sh_offset);
+	sh->sh_size = ELF_GET(msb, sh->sh_size);
+	sh->sh_link = ELF_GET(msb, sh->sh_link);
+	sh->sh_info = ELF_GET(msb, sh->sh_info);
+	sh->sh_addralign = ELF_GET(msb, sh->sh_addralign);
+	sh->sh_entsize = ELF_GET(msb, sh->sh_entsize);
+}
 
-int
+static int
 iself(const char *p, size_t filesize)
 {
-	Elf_Ehdr		*eh = (Elf_Ehdr *)p;
+	Elf_Ehdr		 eh;
 
 	if (filesize < (off_t)sizeof(Elf_Ehdr)) {
 		warnx("file too small to be ELF");
 		return 0;
 	}
 
-	if (eh->e_ehsize < sizeof(Elf_Ehdr) || !IS_ELF(*eh))
+	elf_getehdr(p, &eh);
+
+	if (eh.e_ehsize < sizeof(Elf_Ehdr) || !IS_ELF(eh))
 		return 0;
 
-	if (eh->e_ident[EI_CLASS] != ELFCLASS) {
-		warnx("unexpected word size %u", eh->e_ident[EI_CLASS]);
+	if (eh.e_ident[EI_CLASS] != ELFCLASS) {
+		warnx("unexpected word size %u", eh.e_ident[EI_CLASS]);
 		return 0;
 	}
-	if (eh->e_ident[EI_VERSION] != ELF_TARG_VER) {
-		warnx("unexpected version %u", eh->e_ident[EI_VERSION]);
+	if (eh.e_ident[EI_VERSION] != ELF_TARG_VER) {
+		warnx("unexpected version %u", eh.e_ident[EI_VERSION]);
 		return 0;
 	}
-	if (eh->e_ident[EI_DATA] >= ELFDATANUM) {
-		warnx("unexpected data format %u", eh->e_ident[EI_DATA]);
+	if (eh.e_ident[EI_DATA] != ELFDATA2LSB &&
+	    eh.e_ident[EI_DATA] != ELFDATA2MSB) {
+		warnx("unexpected data format %u", eh.e_ident[EI_DATA]);
 		return 0;
 	}
-	if (eh->e_shoff > filesize) {
-		warnx("bogus section table offset 0x%llx", (off_t)eh->e_shoff);
+	if (eh.e_shoff > filesize) {
+		warnx("bogus section table offset 0x%llx", (off_t)eh.e_shoff);
 		return 0;
 	}
-	if (eh->e_shentsize < sizeof(Elf_Shdr)) {
-		warnx("bogus section header size %u", eh->e_shentsize);
+	if (eh.e_shentsize < sizeof(Elf_Shdr)) {
+		warnx("bogus section header size %u", eh.e_shentsize);
 		return 0;
 	}
-	if (eh->e_shnum > (filesize - eh->e_shoff) / eh->e_shentsize) {
-		warnx("bogus section header count %u", eh->e_shnum);
+	if (eh.e_shnum > (filesize - eh.e_shoff) / eh.e_shentsize) {
+		warnx("bogus section header count %u", eh.e_shnum);
 		return 0;
 	}
-	if (eh->e_shstrndx >= eh->e_shnum) {
-		warnx("bogus string table index %u", eh->e_shstrndx);
+	if (eh.e_shstrndx >= eh.e_shnum) {
+		warnx("bogus string table index %u", eh.e_shstrndx);
 		return 0;
 	}
 
 	return 1;
 }
 
-int
-elf_getshstab(const char *p, size_t filesize, const char **shstab,
-    size_t *shstabsize)
+static int
+elf_getshstab(const char *shtab, size_t filesize, const Elf_Ehdr *eh,
+    int msb, Elf_Shdr *sh)
 {
-	Elf_Ehdr		*eh = (Elf_Ehdr *)p;
-	Elf_Shdr		*sh;
-
-	sh = (Elf_Shdr *)(p + eh->e_shoff + eh->e_shstrndx * eh->e_shentsize);
+	elf_getshdr(shtab, eh, msb, eh->e_shstrndx, sh);
 	if (sh->sh_type != SHT_STRTAB) {
 		warnx("unexpected string table type");
 		return -1;
@@ -92,107 +468,383 @@ elf_getshstab(const char *p, size_t filesize, const char **shstab,
 		warnx("bogus string table size");
 		return -1;
 	}
-	if (shstab != NULL)
-		*shstab = p + sh->sh_offset;
-	if (shstabsize != NULL)
-		*shstabsize = sh->sh_size;
 
 	return 0;
 }
 
-ssize_t
-elf_getsymtab(const char *p, const char *shstab, size_t shstabsz,
-    const Elf_Sym **symtab, size_t *nsymb)
+/* The hash function of the System V ABI. */
+static unsigned long
+elf_hash(const char *name)
 {
-	Elf_Ehdr	*eh = (Elf_Ehdr *)p;
-	Elf_Shdr	*sh;
-	size_t		 snlen;
-	ssize_t		 i;
+	const unsigned char *p = (const unsigned char *)name;
+	unsigned long h = 0, g;
 
-	snlen = strlen(ELF_SYMTAB);
+	while (*p != '\0') {
+		h = (h << 4) + *p++;
+		if ((g = h & 0xf0000000) != 0)
+			h ^= g >> 24;
+		h &= ~g;
+	}
 
-	for (i = 0; i < eh->e_shnum; i++) {
-		sh = (Elf_Shdr *)(p + eh->e_shoff + i * eh->e_shentsize);
+	return h;
+}
+
+/*
+ * Index the sections of the image at offset ``base'' of ``fd'', whose
+ * file header ``hdr'' has already been checked by iself().
+ */
+static struct elfsecidx *
+elf_secidx_create(const char *hdr, int fd, off_t base, size_t filesize)
+{
+	Elf_Ehdr		 eh;
+	Elf_Shdr		 sh;
+	struct elfsecidx	*esi;
+	struct elfsec		*es, **byidx = NULL;
+	struct elfrel		*er;
+	const char		*name, *shtab, *shstab;
+	size_t			 n, h, nrels = 0, shstabsz;
+	ssize_t			 i, symtabidx = -1;
+	int			 msb, bad;
+
+	elf_getehdr(hdr, &eh);
+	msb = (eh.e_ident[EI_DATA] == ELFDATA2MSB);
+
+	esi = calloc(1, sizeof(*esi));
+	if (esi == NULL) {
+		warn(NULL);
+		return NULL;
+	}
+	esi->esi_fd = fd;
+	esi->esi_base = base;
+	esi->esi_pagesz = sysconf(_SC_PAGESIZE);
+	SLIST_INIT(&esi->esi_maps);
+
+	shtab = elf_map(esi, eh.e_shoff, (size_t)eh.e_shnum * eh.e_shentsize);
+	if (shtab == NULL)
+		goto fail;
+
+	/* Find section header string table location and size. */
+	if (elf_getshstab(shtab, filesize, &eh, msb, &sh))
+		goto fail;
+	shstab = elf_map(esi, sh.sh_offset, sh.sh_size);
+	if (shstab == NULL)
+		goto fail;
+	shstabsz = sh.sh_size;
+
+	for (n = 16; n < (size_t)eh.e_shnum * 2; n *= 2)
+		continue;
 
-		if (sh->sh_type != SHT_SYMTAB)
+	esi->esi_secs = calloc(n, sizeof(*esi->esi_secs));
+	byidx = calloc(eh.e_shnum, sizeof(*byidx));
+	esi->esi_rels = calloc(eh.e_shnum, sizeof(*esi->esi_rels));
+	if (esi->esi_secs == NULL || byidx == NULL || esi->esi_rels == NULL) {
+		warn(NULL);
+		goto fail;
+	}
+	esi->esi_nsecs = n;
+	esi->esi_msb = msb;
+	esi->esi_machine = eh.e_machine;
+
+	for (i = 0; i < eh.e_shnum; i++) {
+		elf_getshdr(shtab, &eh, msb, i, &sh);
+
+		if ((sh.sh_link >= eh.e_shnum) || (sh.sh_name >= shstabsz))
 			continue;
 
-		if ((sh->sh_link >= eh->e_shnum) || (sh->sh_name >= shstabsz))
+		name = shstab + sh.sh_name;
+		if (memchr(name, '\0', shstabsz - sh.sh_name) == NULL)
 			continue;
 
-		if (strncmp(shstab + sh->sh_name, ELF_SYMTAB, snlen) == 0) {
-			if (symtab != NULL)
-				*symtab = (Elf_Sym *)(p + sh->sh_offset);
-			if (nsymb != NULL)
-				*nsymb = (sh->sh_size / sh->sh_entsize);
+		/* Sections out of the file are found but never mapped. */
+		bad = sh.sh_offset >= filesize || (sh.sh_type != SHT_NOBITS &&
+		    sh.sh_size > filesize - sh.sh_offset);
+
+		switch (bad ? SHT_NULL : sh.sh_type) {
+		case SHT_SYMTAB:
+			if (symtabidx == -1 && sh.sh_entsize != 0 &&
+			    strcmp(name, ELF_SYMTAB) == 0) {
+				symtabidx = i;
+				esi->esi_symsh = sh;
+				esi->esi_nsymb = sh.sh_size / sh.sh_entsize;
+			}
+			break;
+		case SHT_REL:
+		case SHT_RELA:
+			if (sh.sh_size != 0 && sh.sh_info < eh.e_shnum)
+				esi->esi_rels[nrels++].er_sh = sh;
+			break;
+		}
 
-			return i;
+		/* In case of duplicate names, the first section wins. */
+		for (h = elf_hash(name) & (n - 1); esi->esi_secs[h].es_name;
+		    h = (h + 1) & (n - 1)) {
+			if (strcmp(esi->esi_secs[h].es_name, name) == 0)
+				break;
 		}
+		es = &esi->esi_secs[h];
+		byidx[i] = es;
+		if (es->es_name != NULL)
+			continue;
+
+		es->es_name = name;
+		es->es_idx = i;
+		if (bad) {
+			es->es_error = 1;
+			continue;
+		}
+		es->es_offset = sh.sh_offset;
+		es->es_size = (sh.sh_type == SHT_NOBITS) ? 0 : sh.sh_size;
 	}
 
-	return -1;
+	/*
+	 * Only relocations using the symbol table apply to the sections
+	 * we are interested in, that excludes the dynamic relocations of
+	 * executables and shared objects.
+	 */
+	while (nrels-- > 0) {
+		er = &esi->esi_rels[nrels];
+		if ((ssize_t)er->er_sh.sh_link != symtabidx)
+			continue;
+
+		es = byidx[er->er_sh.sh_info];
+		if (es == NULL || es->es_idx != (ssize_t)er->er_sh.sh_info)
+			continue;
+
+		er->er_next = es->es_rels;
+		es->es_rels = er;
+	}
+
+	/* The section headers have been copied. */
+	elf_unmap(esi, shtab);
+
+	free(byidx);
+	return esi;
+
+fail:
+	free(byidx);
+	elf_secidx_free(esi);
+	return NULL;
+}
+
+static void
+elf_secidx_free(struct elfsecidx *esi)
+{
+	struct elfmap	*em;
+	size_t		 i;
+
+	if (esi == NULL)
+		return;
+
+	for (i = 0; i < esi->esi_nsecs; i++) {
+		free(esi->esi_secs[i].es_copy);
+		free(esi->esi_secs[i].es_lazy);
+	}
+	while ((em = SLIST_FIRST(&esi->esi_maps)) != NULL) {
+		SLIST_REMOVE_HEAD(&esi->esi_maps, em_next);
+		if (em->em_mapped)
+			munmap(em->em_addr, em->em_len);
+		else
+			free(em->em_addr);
+		free(em);
+	}
+	free(esi->esi_secs);
+	free(esi->esi_rels);
+	free(esi);
 }
 
-ssize_t
-elf_getsection(char *p, size_t filesize, const char *sname, const char *shstab,
-    size_t shstabsz, const char **psdata, size_t *pssz)
+/* Map the content of a section the first time it is looked up. */
+static int
+elf_secload(struct elfsecidx *esi, struct elfsec *es)
 {
-	Elf_Ehdr	*eh = (Elf_Ehdr *)p;
-	Elf_Shdr	*sh;
-	char		*sdata = NULL;
-	size_t		 snlen, ssz = 0;
-	ssize_t		 sidx, i;
-
-	snlen = strlen(sname);
-	if (snlen == 0)
+	if (es->es_data != NULL)
+		return 0;
+
+	es->es_data = elf_map(esi, es->es_offset, es->es_size);
+	if (es->es_data == NULL)
 		return -1;
 
-	/* Find the given section. */
-	for (i = 0; i < eh->e_shnum; i++) {
-		sh = (Elf_Shdr *)(p + eh->e_shoff + i * eh->e_shentsize);
+	return 0;
+}
 
-		if ((sh->sh_link >= eh->e_shnum) || (sh->sh_name >= shstabsz))
-			continue;
+/*
+ * Map the entries of a relocation section, and the symbol table they
+ * refer to if it is not mapped yet.
+ */
+static int
+elf_relload(struct elfsecidx *esi, struct elfrel *er)
+{
+	const Elf_Shdr	*sh = &esi->esi_symsh;
 
-		if (sh->sh_offset >= filesize)
-			continue;
+	if (esi->esi_symtab == NULL) {
+		esi->esi_symtab = (const Elf_Sym *)elf_map(esi, sh->sh_offset,
+		    sh->sh_size);
+		if (esi->esi_symtab == NULL)
+			return -1;
+	}
 
-		if (strncmp(shstab + sh->sh_name, sname, snlen) == 0) {
-			sidx = i;
-			sdata = p + sh->sh_offset;
-			ssz = sh->sh_size;
-			elf_reloc_apply(p, shstab, shstabsz, sidx, sdata, ssz);
-			break;
-		}
+	er->er_data = elf_map(esi, er->er_sh.sh_offset, er->er_sh.sh_size);
+	if (er->er_data == NULL)
+		return -1;
+
+	return 0;
+}
+
+static struct elfsec *
+elf_secfind(struct elfsecidx *esi, const char *sname)
+{
+	struct elfsec	*es;
+	size_t		 h, mask = esi->esi_nsecs - 1;
+
+	for (h = elf_hash(sname) & mask; (es = &esi->esi_secs[h])->es_name;
+	    h = (h + 1) & mask) {
+		if (strcmp(es->es_name, sname) == 0)
+			return es;
 	}
 
-	if (sdata == NULL)
+	return NULL;
+}
+
+/*
+ * Map a section and apply its relocations.  Return its index, -1 if there
+ * is no such section or -2 if it could not be mapped or relocated.
+ */
+static ssize_t
+elf_getsection(struct elfsecidx *esi, const char *sname, const char **psdata,
+    size_t *pssz)
+{
+	struct elfsec	*es;
+
+	es = elf_secfind(esi, sname);
+	if (es == NULL)
 		return -1;
+	if (es->es_error || elf_secload(esi, es))
+		return -2;
+
+	if (es->es_rels != NULL && elf_reloc_apply(esi, es)) {
+		es->es_error = 1;
+		return -2;
+	}
 
 	if (psdata != NULL)
-		*psdata = sdata;
+		*psdata = es->es_data;
 	if (pssz != NULL)
-		*pssz = ssz;
+		*pssz = es->es_size;
 
-	return sidx;
+	return es->es_idx;
+}
+
+/*
+ * Like elf_getsection() but do not apply the relocations of the section,
+ * return them sorted by offset in ``drs'' instead.  They stay valid until
+ * the index is freed.
+ */
+static ssize_t
+elf_getsection_lazy(struct elfsecidx *esi, const char *sname,
+    const char **psdata, size_t *pssz, struct dwrelocs *drs)
+{
+	struct elfsec	*es;
+
+	es = elf_secfind(esi, sname);
+	if (es == NULL)
+		return -1;
+	if (es->es_error || elf_secload(esi, es))
+		return -2;
+
+	if (es->es_rels != NULL && es->es_lazy == NULL &&
+	    elf_reloc_resolve(esi, es)) {
+		es->es_error = 1;
+		return -2;
+	}
+
+	drs->drs_relocs = es->es_lazy;
+	drs->drs_nrelocs = es->es_nlazy;
+
+	if (psdata != NULL)
+		*psdata = es->es_data;
+	if (pssz != NULL)
+		*pssz = es->es_size;
+
+	return es->es_idx;
+}
+
+/*
+ * Find where a section is in the file, without mapping it.  The offset
+ * is relative to the beginning of the file, not of the image.  Return
+ * like elf_getsection().
+ */
+static ssize_t
+elf_getsecrange(struct elfsecidx *esi, const char *sname, off_t *poff,
+    size_t *pssz)
+{
+	struct elfsec	*es;
+
+	es = elf_secfind(esi, sname);
+	if (es == NULL)
+		return -1;
+	if (es->es_error)
+		return -2;
+
+	*poff = esi->esi_base + es->es_offset;
+	*pssz = es->es_size;
+
+	return es->es_idx;
 }
 
 static int
-elf_reloc_size(unsigned long type)
+elf_reloc_size(uint16_t machine, unsigned long type)
 {
-	switch (type) {
-#ifdef R_X86_64_64
-	case R_X86_64_64:
-		return sizeof(uint64_t);
-#endif
-#ifdef R_X86_64_32
-	case R_X86_64_32:
-		return sizeof(uint32_t);
-#endif
-#ifdef RELOC_32
-	case RELOC_32:
-		return sizeof(uint32_t);
-#endif
+	switch (machine) {
+	case EM_386:
+		if (type == R_386_32)
+			return sizeof(uint32_t);
+		break;
+	case EM_X86_64:
+		if (type == R_X86_64_64)
+			return sizeof(uint64_t);
+		if (type == R_X86_64_32)
+			return sizeof(uint32_t);
+		break;
+	case EM_ARM:
+		if (type == R_ARM_ABS32)
+			return sizeof(uint32_t);
+		break;
+	case EM_AARCH64:
+		if (type == R_AARCH64_ABS64)
+			return sizeof(uint64_t);
+		if (type == R_AARCH64_ABS32)
+			return sizeof(uint32_t);
+		break;
+	case EM_SPARCV9:
+		if (type == R_SPARC_64 || type == R_SPARC_UA64)
+			return sizeof(uint64_t);
+		/* FALLTHROUGH */
+	case EM_SPARC:
+	case EM_SPARC32PLUS:
+		if (type == R_SPARC_32 || type == R_SPARC_UA32)
+			return sizeof(uint32_t);
+		break;
+	case EM_PPC:
+		if (type == R_PPC_ADDR32)
+			return sizeof(uint32_t);
+		break;
+	case EM_PPC64:
+		if (type == R_PPC64_ADDR64)
+			return sizeof(uint64_t);
+		if (type == R_PPC64_ADDR32)
+			return sizeof(uint32_t);
+		break;
+	case EM_MIPS:
+		if (type == R_MIPS_64)
+			return sizeof(uint64_t);
+		if (type == R_MIPS_32)
+			return sizeof(uint32_t);
+		break;
+	case EM_RISCV:
+		if (type == R_RISCV_64)
+			return sizeof(uint64_t);
+		if (type == R_RISCV_32)
+			return sizeof(uint32_t);
+		break;
 	default:
 		break;
 	}
@@ -200,88 +852,390 @@ elf_reloc_size(unsigned long type)
 	return -1;
 }
 
-#define ELF_WRITE_RELOC(buf, val, rsize)				\
-do {									\
-	if (rsize == 4) {						\
-		uint32_t v32 = val;					\
-		memcpy(buf, &v32, sizeof(v32));				\
-	} else {							\
-		uint64_t v64 = val;					\
-		memcpy(buf, &v64, sizeof(v64));				\
-	}								\
-} while (0)
+/*
+ * Split the r_info field of a relocation, still in the byte order of the
+ * file, in symbol index and type.  MIPS64 stores a 32-bit index followed
+ * by one byte for each of its three types: a composition of several
+ * types is returned as a type that is never applied.
+ */
+static inline void
+elf_reloc_info(const struct elfsecidx *esi, const void *info, size_t *rsymp,
+    size_t *rtypp, const int msb)
+{
+	const uint8_t	*p = info;
+	Elf_Rel		 rel;
+#if ELFSIZE == 64
+	uint32_t	 sym;
 
+	if (esi->esi_machine == EM_MIPS) {
+		memcpy(&sym, p, sizeof(sym));
+		*rsymp = ELF_GET(msb, sym);
+		*rtypp = (uint32_t)p[4] << 24 | p[5] << 16 | p[6] << 8 | p[7];
+		return;
+	}
+#endif
+
+	memcpy(&rel.r_info, p, sizeof(rel.r_info));
+	rel.r_info = ELF_GET(msb, rel.r_info);
+	*rsymp = ELF_R_SYM(rel.r_info);
+	*rtypp = ELF_R_TYPE(rel.r_info);
+
+	/* The upper bits of SPARC V9 types are data. */
+	if (esi->esi_machine == EM_SPARCV9)
+		*rtypp &= 0xff;
+}
+
+/*
+ * Report once per file the relocations of a section that could not be
+ * applied because their type is not supported.
+ */
 static void
-elf_reloc_apply(const char *p, const char *shstab, size_t shstabsz,
-    ssize_t sidx, char *sdata, size_t ssz)
+elf_reloc_unsupported(struct elfsecidx *esi, struct elfsec *es, size_t n)
 {
-	Elf_Ehdr	*eh = (Elf_Ehdr *)p;
-	Elf_Shdr	*sh;
-	Elf_Rel		*rel = NULL;
-	Elf_RelA	*rela = NULL;
-	const Elf_Sym	*symtab, *sym;
-	ssize_t		 symtabidx;
-	size_t		 nsymb, rsym, rtyp, roff;
-	size_t		 i, j;
+	if (n == 0 || esi->esi_badrels)
+		return;
+
+	esi->esi_badrels = 1;
+	warnx("%s: %zu relocations of unsupported types for machine %u",
+	    es->es_name, n, esi->esi_machine);
+}
+
+/*
+ * Apply the relocations ``from'' to ``to'' of the relocation section
+ * ``er'' to a copy of its target.  The loop is compiled once for each
+ * byte order.  Return the number of relocations of unsupported types.
+ */
+static inline size_t
+elf_reloc_range_order(const struct elfsecidx *esi, const struct elfrel *er,
+    char *sdata, size_t ssz, size_t from, size_t to, const int msb)
+{
+	const Elf_Shdr	*sh = &er->er_sh;
+	const Elf_Sym	*symtab = esi->esi_symtab, *sym;
+	const Elf_Rel	*rel = NULL;
+	const Elf_RelA	*rela = NULL;
+	size_t		 nsymb = esi->esi_nsymb;
+	size_t		 rsym, rtyp, roff;
+	size_t		 j, nbad = 0;
 	uint64_t	 value;
 	int		 rsize;
 
-	/* Find symbol table location and number of symbols. */
-	symtabidx = elf_getsymtab(p, shstab, shstabsz, &symtab, &nsymb);
-	if (symtabidx == -1) {
-		warnx("symbol table not found");
-		return;
+	switch (sh->sh_type) {
+	case SHT_RELA:
+		rela = (const Elf_RelA *)er->er_data;
+		for (j = from; j < to; j++) {
+			elf_reloc_info(esi, &rela[j].r_info, &rsym, &rtyp, msb);
+			roff = ELF_GET(msb, rela[j].r_offset);
+			if (rsym >= nsymb)
+				continue;
+			sym = &symtab[rsym];
+			value = ELF_GET(msb, sym->st_value) +
+			    ELF_GET(msb, rela[j].r_addend);
+
+			rsize = elf_reloc_size(esi->esi_machine, rtyp);
+			if (rsize == -1)
+				nbad++;
+			if (rsize == -1 || roff + rsize >= ssz)
+				continue;
+
+			ELF_WRITE_RELOC(sdata + roff, value, rsize, msb);
+		}
+		break;
+	case SHT_REL:
+		rel = (const Elf_Rel *)er->er_data;
+		for (j = from; j < to; j++) {
+			elf_reloc_info(esi, &rel[j].r_info, &rsym, &rtyp, msb);
+			roff = ELF_GET(msb, rel[j].r_offset);
+			if (rsym >= nsymb)
+				continue;
+			sym = &symtab[rsym];
+
+			rsize = elf_reloc_size(esi->esi_machine, rtyp);
+			if (rsize == -1)
+				nbad++;
+			if (rsize == -1 || roff + rsize >= ssz)
+				continue;
+
+			value = ELF_GET(msb, sym->st_value) +
+			    elf_reloc_addend(sdata + roff, rsize, msb);
+
+			ELF_WRITE_RELOC(sdata + roff, value, rsize, msb);
+		}
+		break;
+	default:
+		break;
 	}
 
-	/* Apply possible relocation. */
-	for (i = 0; i < eh->e_shnum; i++) {
-		sh = (Elf_Shdr *)(p + eh->e_shoff + i * eh->e_shentsize);
+	return nbad;
+}
 
-		if (sh->sh_size == 0)
+static size_t
+elf_reloc_range(const struct elfsecidx *esi, const struct elfrel *er,
+    char *sdata, size_t ssz, size_t from, size_t to)
+{
+	if (esi->esi_msb)
+		return elf_reloc_range_order(esi, er, sdata, ssz, from, to, 1);
+	return elf_reloc_range_order(esi, er, sdata, ssz, from, to, 0);
+}
+
+static size_t
+elf_reloc_count(const Elf_Shdr *sh)
+{
+	if (sh->sh_type == SHT_RELA)
+		return sh->sh_size / sizeof(Elf_RelA);
+	return sh->sh_size / sizeof(Elf_Rel);
+}
+
+/*
+ * Tell if the relocations of ``er'' are sorted by offset and do not
+ * overlap, in which case they can be applied in any order.
+ */
+static int
+elf_reloc_disjoint(const struct elfsecidx *esi, const struct elfrel *er)
+{
+	const Elf_Shdr	*sh = &er->er_sh;
+	const Elf_Rel	*rel;
+	const Elf_RelA	*rela;
+	size_t		 j, n = elf_reloc_count(sh);
+	size_t		 rsym, rtyp;
+	uint64_t	 roff, next = 0;
+	int		 msb = esi->esi_msb, rsize;
+
+	for (j = 0; j < n; j++) {
+		if (sh->sh_type == SHT_RELA) {
+			rela = (const Elf_RelA *)er->er_data + j;
+			roff = ELF_GET(msb, rela->r_offset);
+			elf_reloc_info(esi, &rela->r_info, &rsym, &rtyp, msb);
+		} else {
+			rel = (const Elf_Rel *)er->er_data + j;
+			roff = ELF_GET(msb, rel->r_offset);
+			elf_reloc_info(esi, &rel->r_info, &rsym, &rtyp, msb);
+		}
+
+		rsize = elf_reloc_size(esi->esi_machine, rtyp);
+		if (rsize == -1)
 			continue;
+		if (roff < next)
+			return 0;
+		next = roff + rsize;
+	}
+
+	return 1;
+}
+
+#define ELF_RELOC_CHUNK		65536	/* minimum per thread */
+#define ELF_RELOC_MAXTHREADS	16
+
+struct elfrelwork {
+	pthread_t		 erw_thread;
+	const struct elfsecidx	*erw_esi;
+	const struct elfrel	*erw_er;
+	char			*erw_sdata;
+	size_t			 erw_ssz;
+	size_t			 erw_from;
+	size_t			 erw_to;
+	size_t			 erw_nbad;
+};
+
+static void *
+elf_reloc_worker(void *arg)
+{
+	struct elfrelwork *erw = arg;
+
+	erw->erw_nbad = elf_reloc_range(erw->erw_esi, erw->erw_er,
+	    erw->erw_sdata, erw->erw_ssz, erw->erw_from, erw->erw_to);
+
+	return NULL;
+}
+
+/*
+ * Split the relocations of ``er'' in chunks applied by as many threads.
+ * If a thread cannot be created its chunk is applied by the caller.
+ * Return the number of relocations of unsupported types.
+ */
+static size_t
+elf_reloc_parallel(const struct elfsecidx *esi, const struct elfrel *er,
+    char *sdata, size_t ssz, size_t nthreads)
+{
+	struct elfrelwork	 erw[ELF_RELOC_MAXTHREADS];
+	size_t			 i, n = elf_reloc_count(&er->er_sh);
+	size_t			 nbad = 0;
+	int			 started[ELF_RELOC_MAXTHREADS];
+
+	for (i = 0; i < nthreads; i++) {
+		erw[i].erw_esi = esi;
+		erw[i].erw_er = er;
+		erw[i].erw_sdata = sdata;
+		erw[i].erw_ssz = ssz;
+		erw[i].erw_from = n * i / nthreads;
+		erw[i].erw_to = n * (i + 1) / nthreads;
+
+		started[i] = (i > 0 && pthread_create(&erw[i].erw_thread, NULL,
+		    elf_reloc_worker, &erw[i]) == 0);
+		if (i > 0 && !started[i])
+			elf_reloc_worker(&erw[i]);
+	}
+
+	elf_reloc_worker(&erw[0]);
+
+	for (i = 1; i < nthreads; i++) {
+		if (started[i])
+			pthread_join(erw[i].erw_thread, NULL);
+	}
+
+	for (i = 0; i < nthreads; i++)
+		nbad += erw[i].erw_nbad;
+
+	return nbad;
+}
+
+/*
+ * Copy a section and apply its relocations to the copy, once.  Large
+ * relocation sections are applied by several threads when their
+ * entries do not overlap, so the result does not depend on the order
+ * in which they are applied.
+ */
+static int
+elf_reloc_apply(struct elfsecidx *esi, struct elfsec *es)
+{
+	const Elf_Shdr	*sh;
+	struct elfrel	*er;
+	char		*sdata;
+	size_t		 ssz = es->es_size, n, nthreads, nbad = 0;
+	long		 ncpu;
+
+	sdata = malloc(ssz);
+	if (sdata == NULL) {
+		warn(NULL);
+		return -1;
+	}
+	memcpy(sdata, es->es_data, ssz);
+
+	ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	if (ncpu < 1)
+		ncpu = 1;
 
-		if ((sh->sh_info != sidx) || (sh->sh_link != symtabidx))
+	for (er = es->es_rels; er != NULL; er = er->er_next) {
+		sh = &er->er_sh;
+		if (sh->sh_type != SHT_RELA && sh->sh_type != SHT_REL)
 			continue;
+		if (elf_relload(esi, er)) {
+			free(sdata);
+			return -1;
+		}
 
-		switch (sh->sh_type) {
-		case SHT_RELA:
-			rela = (Elf_RelA *)(p + sh->sh_offset);
-			for (j = 0; j < (sh->sh_size / sizeof(Elf_RelA)); j++) {
-				rsym = ELF_R_SYM(rela[j].r_info);
-				rtyp = ELF_R_TYPE(rela[j].r_info);
-				roff = rela[j].r_offset;
-				if (rsym >= nsymb)
-					continue;
-				sym = &symtab[rsym];
-				value = sym->st_value + rela[j].r_addend;
-
-				rsize = elf_reloc_size(rtyp);
-				if (rsize == -1 || roff + rsize >= ssz)
-					continue;
-
-				ELF_WRITE_RELOC(sdata + roff, value, rsize);
-			}
-			break;
-		case SHT_REL:
-			rel = (Elf_Rel *)(p + sh->sh_offset);
-			for (j = 0; j < (sh->sh_size / sizeof(Elf_Rel)); j++) {
-				rsym = ELF_R_SYM(rel[j].r_info);
-				rtyp = ELF_R_TYPE(rel[j].r_info);
-				roff = rel[j].r_offset;
-				if (rsym >= nsymb)
-					continue;
-				sym = &symtab[rsym];
-				value = sym->st_value;
-
-				rsize = elf_reloc_size(rtyp);
-				if (rsize == -1 || roff + rsize >= ssz)
-					continue;
-
-				ELF_WRITE_RELOC(sdata + roff, value, rsize);
+		n = elf_reloc_count(sh);
+		nthreads = n / ELF_RELOC_CHUNK;
+		if (nthreads > (size_t)ncpu)
+			nthreads = ncpu;
+		if (nthreads > ELF_RELOC_MAXTHREADS)
+			nthreads = ELF_RELOC_MAXTHREADS;
+
+		if (nthreads > 1 && elf_reloc_disjoint(esi, er))
+			nbad += elf_reloc_parallel(esi, er, sdata, ssz,
+			    nthreads);
+		else
+			nbad += elf_reloc_range(esi, er, sdata, ssz, 0, n);
+		elf_unmap(esi, er->er_data);
+	}
+	elf_reloc_unsupported(esi, es, nbad);
+
+	/* Only replace the section once all relocations are applied. */
+	elf_unmap(esi, es->es_data);
+	es->es_data = es->es_copy = sdata;
+	es->es_rels = NULL;
+
+	return 0;
+}
+
+static int
+elf_reloc_cmp(const void *a, const void *b)
+{
+	const struct dwreloc *da = a, *db = b;
+
+	if (da->drl_offset < db->drl_offset)
+		return -1;
+	return (da->drl_offset > db->drl_offset);
+}
+
+/* Compute the values of the relocations of a section and sort them. */
+static int
+elf_reloc_resolve(struct elfsecidx *esi, struct elfsec *es)
+{
+	const Elf_Sym	*symtab, *sym;
+	const Elf_Shdr	*sh;
+	const Elf_Rel	*rel;
+	const Elf_RelA	*rela;
+	struct elfrel	*er;
+	struct dwreloc	*drl;
+	size_t		 ssz = es->es_size, nsymb = esi->esi_nsymb;
+	size_t		 rsym, rtyp, roff, nrels = 0, n = 0;
+	size_t		 j, nents, nbad = 0;
+	int		 msb = esi->esi_msb, rsize;
+
+	for (er = es->es_rels; er != NULL; er = er->er_next)
+		nrels += er->er_sh.sh_size / sizeof(Elf_Rel);
+
+	drl = reallocarray(NULL, nrels, sizeof(*drl));
+	if (drl == NULL) {
+		warn(NULL);
+		return -1;
+	}
+
+	for (er = es->es_rels; er != NULL; er = er->er_next) {
+		sh = &er->er_sh;
+		nents = elf_reloc_count(sh);
+
+		if (elf_relload(esi, er)) {
+			free(drl);
+			return -1;
+		}
+		symtab = esi->esi_symtab;
+		rela = (const Elf_RelA *)er->er_data;
+		rel = (const Elf_Rel *)er->er_data;
+
+		for (j = 0; j < nents; j++) {
+			if (sh->sh_type == SHT_RELA) {
+				elf_reloc_info(esi, &rela[j].r_info, &rsym,
+				    &rtyp, msb);
+				roff = ELF_GET(msb, rela[j].r_offset);
+				drl[n].drl_value =
+				    ELF_GET(msb, rela[j].r_addend);
+			} else {
+				elf_reloc_info(esi, &rel[j].r_info, &rsym,
+				    &rtyp, msb);
+				roff = ELF_GET(msb, rel[j].r_offset);
 			}
+			rsize = elf_reloc_size(esi->esi_machine, rtyp);
+			if (rsize == -1)
+				nbad++;
+
+			if (rsym >= nsymb || rsize == -1 || roff + rsize >= ssz)
+				continue;
+			sym = &symtab[rsym];
+
+			if (sh->sh_type == SHT_REL)
+				drl[n].drl_value = elf_reloc_addend(
+				    es->es_data + roff, rsize, msb);
+
+			drl[n].drl_offset = roff;
+			drl[n].drl_value += ELF_GET(msb, sym->st_value);
+			drl[n].drl_size = rsize;
+			n++;
+		}
+		elf_unmap(esi, er->er_data);
+	}
+
+	/* Assemblers generally emit them in order already. */
+	for (j = 1; j < n; j++) {
+		if (drl[j - 1].drl_offset > drl[j].drl_offset) {
+			qsort(drl, n, sizeof(*drl), elf_reloc_cmp);
 			break;
-		default:
-			continue;
 		}
 	}
+
+	es->es_lazy = drl;
+	es->es_nlazy = n;
+	elf_reloc_unsupported(esi, es, nbad);
+
+	return 0;
 }
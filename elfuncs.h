@@ -0,0 +1,48 @@
+/*
+ * Copyright (c) 2016 Martin Pieuchot
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#ifndef _ELFUNCS_H_
+#define _ELFUNCS_H_
+
+struct dwrelocs;
+struct elfsecidx;
+
+/*
+ * Entry points of elf.c, compiled for each ELF class.  They accept files
+ * of either byte order.  The file header is read by the caller, the
+ * index reads the rest of the image from the file descriptor.
+ */
+struct elfops {
+	int		 (*eo_iself)(const char *, size_t);
+	struct elfsecidx *(*eo_secidx_create)(const char *, int, off_t,
+			     size_t);
+	void		 (*eo_secidx_free)(struct elfsecidx *);
+	ssize_t		 (*eo_getsection)(struct elfsecidx *, const char *,
+			     const char **, size_t *);
+	ssize_t		 (*eo_getsection_lazy)(struct elfsecidx *,
+			     const char *, const char **, size_t *,
+			     struct dwrelocs *);
+	void		 (*eo_advise)(struct elfsecidx *, const char *,
+			     size_t, int);
+	ssize_t		 (*eo_getsecrange)(struct elfsecidx *, const char *,
+			     off_t *, size_t *);
+};
+
+extern const struct elfops elf32_ops;
+extern const struct elfops elf64_ops;
+
+#endif /* _ELFUNCS_H_ */
@@ -21,9 +21,14 @@
 #include <sys/mman.h>
 #include <sys/queue.h>
 
+#include <ar.h>
+#include <ctype.h>
 #include <err.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <locale.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -33,6 +38,7 @@
 #include "dwarf.h"
 
 #include "dw.h"
+#include "elfuncs.h"
 
 #ifndef nitems
 #define nitems(_a)	(sizeof((_a)) / sizeof((_a)[0]))
@@ -48,52 +54,299 @@
 #define DUMP_LINE	(1 << 2)
 #define DUMP_STR	(1 << 3)
 
-int		 dump(const char *, uint8_t);
-__dead void	 usage(void);
+/* Dumped parts of .debug_info are released by chunks of this size. */
+#define INFO_RELEASE_SIZE	(1024 * 1024)
+
+/*
+ * When several files are dumped, a loader thread opens and indexes the
+ * next ones and reads their debug sections, so they are in the page
+ * cache when they are mapped.  It runs at most LOAD_AHEAD files ahead.
+ *
+ * With -j, files are dumped by worker threads in memory buffers instead,
+ * written in order by the main thread.  Workers run at most FILE_WINDOW
+ * files ahead of the last one written.
+ *
+ * With -p, the loader thread of dump_pipeline() also maps the sections
+ * of the ELF images, archive members included, applies the relocations
+ * of .debug_info and scans its units, at most IMAGE_AHEAD images ahead
+ * of the main thread.  The units are then formatted by the workers of
+ * dump_units() and written in order by the main thread.
+ */
+#define LOAD_AHEAD	8
+#define LOAD_CHUNK	(64 * 1024)
+#define FILE_WINDOW(n)	(2 * (n))
+#define IMAGE_AHEAD	2
 
-int		 dwarf_dump(char *, size_t, uint8_t);
-int		 dump_cu(struct dwcu *);
-void		 dump_dav(struct dwaval *, size_t, size_t);
+/*
+ * Output of a worker thread in a memory buffer, written in order by the
+ * main thread with wb_write().  Functions dumping with threads return -1
+ * if none could be started, before writing anything, so their caller
+ * falls back to the serial dump.
+ */
+struct wrbuf {
+	char			*wb_buf;
+	size_t			 wb_len;
+	int			 wb_error;
+	int			 wb_done;	/* by the worker */
+};
+
+struct ldfile {
+	const char		*lf_path;
+	int			 lf_fd;		/* -1 on error */
+	size_t			 lf_size;
+	int			 lf_isar;	/* ar(1) archive */
+	int			 lf_msb;
+	const struct elfops	*lf_ops;
+	struct elfsecidx	*lf_esi;
+	struct wrbuf		 lf_out;	/* with -j */
+};
+
+/* Sections of an ELF image read by dwarf_load(). */
+struct dwsecs {
+	struct dwbuf		 ds_abbrev;
+	struct dwbuf		 ds_info;
+	struct dwbuf		 ds_str;
+	struct dwrelocs		 ds_drs;	/* with -r */
+	int			 ds_cuflags;
+	struct dwcutab		 ds_dct;	/* if the units are looked up */
+};
+
+#define DS_RELOCS(ds)	(((ds)->ds_drs.drs_nrelocs > 0) ? &(ds)->ds_drs : NULL)
+
+/* ELF image loaded by the loader thread of dump_pipeline(). */
+struct plimage {
+	SIMPLEQ_ENTRY(plimage)	 pi_next;
+	const char		*pi_path;
+	char			*pi_member;	/* of an archive, or NULL */
+	const struct elfops	*pi_ops;
+	struct elfsecidx	*pi_esi;	/* NULL if not indexed */
+	struct dwsecs		 pi_ds;
+	int			 pi_error;
+};
+
+SIMPLEQ_HEAD(plimage_queue, plimage);
+
+/* Reader of the ELF members of an ar(1) archive, see ar_next(). */
+struct arreader {
+	const char		*arr_path;
+	int			 arr_fd;
+	size_t			 arr_size;	/* of the file */
+	size_t			 arr_next;	/* offset of the next header */
+	char			*arr_strtab;	/* GNU long names */
+	size_t			 arr_strtablen;
+	char			 arr_name[PATH_MAX];	/* current member */
+	size_t			 arr_off;
+	size_t			 arr_len;
+};
+
+/* Use of a queue between two stages of the pipeline. */
+struct ldqueue {
+	size_t			 lq_maxdepth;
+	uint64_t		 lq_nsamples;
+	uint64_t		 lq_sumdepth;	/* sampled once per entry */
+	uint64_t		 lq_nfull;	/* producer stalls */
+	uint64_t		 lq_nempty;	/* consumer stalls */
+};
+
+struct loader {
+	pthread_t		 ld_thread;
+	pthread_mutex_t		 ld_mtx;
+	pthread_cond_t		 ld_cond;
+	struct ldfile		*ld_files;
+	size_t			 ld_nfiles;
+	size_t			 ld_nloaded;	/* by the loader thread */
+	size_t			 ld_ndumped;	/* by the main thread */
+	size_t			 ld_next;	/* next file to dump, with -j */
+	uint8_t			 ld_flags;
+	struct plimage_queue	 ld_images;	/* loaded, with -p */
+	size_t			 ld_nimages;
+	int			 ld_loaded;	/* all images are queued */
+	struct ldqueue		 ld_loadq;	/* loader to main thread */
+	struct ldqueue		 ld_parseq;	/* workers to main thread */
+};
+
+/*
+ * With -j the units of .debug_info are formatted by worker threads in
+ * memory buffers, written in order by the main thread.  Workers run at
+ * most CU_WINDOW units ahead of the last one written.
+ *
+ * Units bigger than CU_SPLIT_SIZE are split in parts of about this size
+ * at the boundaries of their top-level DIEs, formatted by any worker.
+ *
+ * Workers do not start a unit while CU_BUFFERED bytes of output are
+ * waiting to be written, unless all the previous units are written.
+ */
+#define CU_WINDOW(n)	(4 * (n))
+#define CU_SPLIT_SIZE	(256 * 1024)
+#define CU_BUFFERED	(4 * 1024 * 1024)
+#define MAXJOBS		256
+
+struct cutask {
+	SIMPLEQ_ENTRY(cutask)	 ct_next;	/* in the queue of the pool */
+	SIMPLEQ_ENTRY(cutask)	 ct_link;	/* parts of the unit */
+	size_t			 ct_unit;
+	size_t			 ct_start;	/* first DIE, 0 if header */
+	size_t			 ct_end;	/* first DIE of the next part */
+	uint8_t			 ct_lvl;	/* of the first DIE */
+	struct wrbuf		 ct_out;
+};
+
+SIMPLEQ_HEAD(cutask_queue, cutask);
+
+struct cuout {
+	struct cutask		 co_first;	/* header and first DIEs */
+	struct cutask_queue	 co_parts;	/* in unit order */
+	int			 co_split;	/* all parts are known */
+};
+
+struct cupool {
+	pthread_mutex_t		 cp_mtx;
+	pthread_cond_t		 cp_cond;
+	const struct dwcutab	*cp_dct;
+	struct dwbuf		 cp_info;	/* whole segment */
+	struct dwbuf		 cp_abbrev;
+	const struct dwrelocs	*cp_drs;
+	struct dwabcache	*cp_dac;	/* frozen */
+	const struct dwbuf	*cp_dstr;
+	int			 cp_cuflags;
+	struct cuout		*cp_outs;
+	struct cutask_queue	 cp_tasks;	/* parts of split units */
+	size_t			 cp_nsplitting;
+	size_t			 cp_window;
+	size_t			 cp_next;	/* next unit to format */
+	size_t			 cp_nwritten;	/* by the main thread */
+	size_t			 cp_nbuffered;	/* output bytes not written */
+	struct ldqueue		 cp_queue;	/* formatted units */
+	int			 cp_stop;
+};
+
+int		 dump_all(char **, size_t, uint8_t);
+int		 wb_write(FILE *, struct wrbuf *, pthread_mutex_t *,
+		    pthread_cond_t *, size_t *, size_t);
+int		 dump_files(struct loader *, uint8_t, int *);
+void		*df_main(void *);
+int		 dump_pipeline(struct loader *, uint8_t, int *);
+void		*pl_load(void *);
+struct plimage	*pl_image(const char *, const char *);
+void		 pl_push(struct loader *, struct plimage *, int, int, char *);
+void		 pl_depth(struct ldqueue *, size_t);
+void		 pl_merge(struct ldqueue *, const struct ldqueue *);
+void		 pl_stats(const char *, struct ldqueue *);
+int		 dump_file(FILE *, struct ldfile *, uint8_t);
+int		 dump_elf(FILE *, int, off_t, size_t, uint8_t);
+int		 dump_ar(FILE *, const char *, int, size_t, uint8_t);
+int		 readat(int, void *, size_t, off_t);
+__dead void	 usage(void);
 
-/* elf.c */
-int		 iself(const char *, size_t);
-int		 elf_getshstab(const char *, size_t, const char **, size_t *);
-ssize_t		 elf_getsymtab(const char *, const char *, size_t,
-		     const Elf_Sym **, size_t *);
-ssize_t		 elf_getsection(char *, size_t, const char *, const char *,
-		     size_t, const char **, size_t *);
+int		 ld_open(struct ldfile *);
+void		 ld_prefetch(const struct elfops *, struct elfsecidx *, int,
+		     char *);
+void		*ld_main(void *);
+
+struct elfsecidx *elf_index(int, off_t, size_t, const struct elfops **,
+		     int *);
+
+void		 ar_init(struct arreader *, const char *, int, size_t);
+int		 ar_next(struct arreader *);
+void		 ar_free(struct arreader *);
+int		 ar_getnum(const char *, size_t, size_t *);
+int		 ar_getname(const struct ar_hdr *, int, size_t, size_t,
+		     const char *, size_t, char *, size_t, size_t *);
+
+const struct elfops *elf_getops(const char *, size_t);
+int		 dwarf_dump(FILE *, const struct elfops *, struct elfsecidx *,
+		     int, uint8_t);
+int		 dwarf_load(const struct elfops *, struct elfsecidx *, int,
+		     uint8_t, struct dwsecs *);
+int		 dwarf_format(FILE *, const struct elfops *, struct elfsecidx *,
+		     struct dwsecs *, struct ldqueue *, uint8_t);
+void		 secwarn(const char *, ssize_t);
+int		 dump_seek(struct dwbuf *, struct dwcutab *);
+int		 dump_units(FILE *, const struct elfops *, struct elfsecidx *,
+		     struct dwsecs *, struct dwabcache *, struct ldqueue *);
+void		*cu_worker(void *);
+int		 cu_room(struct cupool *);
+int		 cu_split(struct cupool *, size_t, struct dwarena *);
+void		 cu_format(struct cupool *, struct cutask *, struct dwarena *);
+int		 dump_cu(FILE *, struct dwcu *, size_t, const struct dwbuf *);
+int		 dump_dies(FILE *, struct dwcu *, size_t, const struct dwbuf *);
+void		 dump_dav(FILE *, struct dwaval *, size_t, size_t,
+		     const struct dwbuf *);
 
 uint64_t	 dav2val(struct dwaval *, size_t);
-const char	*dav2str(struct dwaval *);
+const char	*dav2str(struct dwaval *, const struct dwbuf *);
 const char	*enc2name(unsigned short);
 const char	*lang2name(unsigned short);
 const char	*inline2name(unsigned short);
 
+int		 cflag;		/* dump a single unit, by index */
+size_t		 cuindex;
+int		 oflag;		/* or by offset */
+size_t		 cuoffset;
+int		 pflag;
+int		 rflag;
+int		 vflag;
+long long	 njobs = 1;	/* threads dumping files */
+long long	 cujobs = 1;	/* threads formatting units */
+
 __dead void
 usage(void)
 {
-	fprintf(stderr, "usage: %s [-ai] [file ...]\n",
-	    getprogname());
+	fprintf(stderr, "usage: %s [-aiprv] [-c index | -o offset] [-j jobs] "
+	    "[file ...]\n", getprogname());
 	exit(1);
 }
 
 int
 main(int argc, char *argv[])
 {
-	const char *filename;
 	uint8_t flags = 0;
+	const char *errstr;
+	char *end;
+	unsigned long long ull;
 	int ch, error = 0;
 
 	setlocale(LC_ALL, "");
 
-	while ((ch = getopt(argc, argv, "ai")) != -1) {
+	while ((ch = getopt(argc, argv, "ac:ij:o:prv")) != -1) {
 		switch (ch) {
 		case 'a':
 			flags |= DUMP_ABBREV;
 			break;
+		case 'c':
+			cuindex = strtonum(optarg, 0, MIN(SIZE_MAX, LLONG_MAX),
+			    &errstr);
+			if (errstr != NULL)
+				errx(1, "unit index is %s: %s", errstr, optarg);
+			cflag = 1;
+			break;
+		case 'o':
+			errno = 0;
+			ull = strtoull(optarg, &end, 0);
+			if (!isdigit((unsigned char)optarg[0]) ||
+			    *end != '\0' || errno != 0 || ull > SIZE_MAX)
+				errx(1, "invalid unit offset: %s", optarg);
+			cuoffset = ull;
+			oflag = 1;
+			break;
 		case 'i':
 			flags |= DUMP_INFO;
 			break;
+		case 'j':
+			njobs = strtonum(optarg, 1, MAXJOBS, &errstr);
+			if (errstr != NULL)
+				errx(1, "number of jobs is %s: %s", errstr,
+				    optarg);
+			break;
+		case 'p':
+			pflag = 1;
+			break;
+		case 'r':
+			rflag = 1;
+			break;
+		case 'v':
+			vflag = 1;
+			break;
 		default:
 			usage();
 		}
@@ -102,157 +355,1416 @@ main(int argc, char *argv[])
 	argc -= optind;
 	argv += optind;
 
-	if (argc <= 0)
+	if (argc <= 0 || (cflag && oflag))
 		usage();
 
+	/* Files dumped in parallel do not go through the pipeline. */
+	if (pflag && njobs > 1 && argc > 1)
+		errx(1, "-p cannot be used with -j and several files");
+
+	/* A unit is selected in the info section. */
+	if (cflag || oflag)
+		flags |= DUMP_INFO;
+
 	/* Dump everything by default */
 	if (flags == 0)
 		flags = 0xff;
 
-	while ((filename = *argv++) != NULL)
-		error |= dump(filename, flags);
+	/* Several files are dumped in parallel, their units serially. */
+	if (argc == 1)
+		cujobs = njobs;
+
+	error = dump_all(argv, argc, flags);
 
 	return error;
 }
 
+/* Dump files in order while the loader thread prepares the next ones. */
+int
+dump_all(char **paths, size_t npaths, uint8_t flags)
+{
+	struct loader		 ld;
+	struct ldfile		*lf;
+	size_t			 i;
+	int			 error = 0;
+
+	ld.ld_files = calloc(npaths, sizeof(*ld.ld_files));
+	if (ld.ld_files == NULL)
+		err(1, NULL);
+	for (i = 0; i < npaths; i++)
+		ld.ld_files[i].lf_path = paths[i];
+	ld.ld_nfiles = npaths;
+	ld.ld_nloaded = ld.ld_ndumped = ld.ld_next = 0;
+	ld.ld_flags = flags;
+	SIMPLEQ_INIT(&ld.ld_images);
+	ld.ld_nimages = 0;
+	ld.ld_loaded = 0;
+	memset(&ld.ld_loadq, 0, sizeof(ld.ld_loadq));
+	memset(&ld.ld_parseq, 0, sizeof(ld.ld_parseq));
+	pthread_mutex_init(&ld.ld_mtx, NULL);
+	pthread_cond_init(&ld.ld_cond, NULL);
+
+	if (njobs > 1 && npaths > 1 && dump_files(&ld, flags, &error) == 0)
+		goto out;
+
+	if (pflag && dump_pipeline(&ld, flags, &error) == 0)
+		goto out;
+
+	/* A single file is not worth a thread. */
+	if (npaths == 1 ||
+	    pthread_create(&ld.ld_thread, NULL, ld_main, &ld) != 0) {
+		for (i = 0; i < npaths; i++) {
+			lf = &ld.ld_files[i];
+			if (ld_open(lf) == 0)
+				error |= dump_file(stdout, lf, flags);
+			else
+				error = 1;
+		}
+		goto out;
+	}
+
+	for (i = 0; i < npaths; i++) {
+		pthread_mutex_lock(&ld.ld_mtx);
+		while (ld.ld_nloaded <= i)
+			pthread_cond_wait(&ld.ld_cond, &ld.ld_mtx);
+		pthread_mutex_unlock(&ld.ld_mtx);
+
+		lf = &ld.ld_files[i];
+		if (lf->lf_fd != -1)
+			error |= dump_file(stdout, lf, flags);
+		else
+			error = 1;
+
+		pthread_mutex_lock(&ld.ld_mtx);
+		ld.ld_ndumped = i + 1;
+		pthread_cond_broadcast(&ld.ld_cond);
+		pthread_mutex_unlock(&ld.ld_mtx);
+	}
+
+	pthread_join(ld.ld_thread, NULL);
+out:
+	pthread_cond_destroy(&ld.ld_cond);
+	pthread_mutex_destroy(&ld.ld_mtx);
+	free(ld.ld_files);
+
+	return error;
+}
+
+/*
+ * Wait until a worker is done with the output ``wb'', write it to ``fp''
+ * and free it.  If ``countp'' is not NULL, set it to ``count'' to let the
+ * workers waiting for room go on.  Return 1 if the output was not ready.
+ */
+int
+wb_write(FILE *fp, struct wrbuf *wb, pthread_mutex_t *mtx,
+    pthread_cond_t *cond, size_t *countp, size_t count)
+{
+	int			 waited;
+
+	pthread_mutex_lock(mtx);
+	waited = !wb->wb_done;
+	while (!wb->wb_done)
+		pthread_cond_wait(cond, mtx);
+	pthread_mutex_unlock(mtx);
+
+	fwrite(wb->wb_buf, 1, wb->wb_len, fp);
+	free(wb->wb_buf);
+	wb->wb_buf = NULL;
+
+	if (countp != NULL) {
+		pthread_mutex_lock(mtx);
+		*countp = count;
+		pthread_cond_broadcast(cond);
+		pthread_mutex_unlock(mtx);
+	}
+
+	return waited;
+}
+
+/*
+ * Dump files with ``njobs'' worker threads, the exit status is the one
+ * of the serial dump.
+ */
+int
+dump_files(struct loader *ld, uint8_t flags, int *errorp)
+{
+	struct ldfile		*lf;
+	pthread_t		*threads;
+	size_t			 i, nthreads;
+	int			 error = 0;
+
+	threads = calloc(njobs, sizeof(*threads));
+	if (threads == NULL)
+		err(1, NULL);
+
+	ld->ld_flags = flags;
+	for (nthreads = 0; nthreads < (size_t)njobs; nthreads++) {
+		if (pthread_create(&threads[nthreads], NULL, df_main,
+		    ld) != 0)
+			break;
+	}
+	if (nthreads == 0) {
+		free(threads);
+		return -1;
+	}
+
+	for (i = 0; i < ld->ld_nfiles; i++) {
+		lf = &ld->ld_files[i];
+		wb_write(stdout, &lf->lf_out, &ld->ld_mtx, &ld->ld_cond,
+		    &ld->ld_ndumped, i + 1);
+		error |= lf->lf_out.wb_error;
+	}
+
+	for (i = 0; i < nthreads; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+
+	*errorp = error;
+	return 0;
+}
+
+/* Worker of dump_files(), dump the next file in a memory buffer. */
+void *
+df_main(void *arg)
+{
+	struct loader		*ld = arg;
+	struct ldfile		*lf;
+	struct wrbuf		*wb;
+	FILE			*fp;
+
+	pthread_mutex_lock(&ld->ld_mtx);
+	for (;;) {
+		while (ld->ld_next < ld->ld_nfiles &&
+		    ld->ld_next >= ld->ld_ndumped + FILE_WINDOW(njobs))
+			pthread_cond_wait(&ld->ld_cond, &ld->ld_mtx);
+		if (ld->ld_next >= ld->ld_nfiles)
+			break;
+		lf = &ld->ld_files[ld->ld_next++];
+		pthread_mutex_unlock(&ld->ld_mtx);
+
+		wb = &lf->lf_out;
+		fp = open_memstream(&wb->wb_buf, &wb->wb_len);
+		if (fp == NULL) {
+			warn("open_memstream");
+			wb->wb_error = 1;
+		} else {
+			if (ld_open(lf) == 0)
+				wb->wb_error = dump_file(fp, lf, ld->ld_flags);
+			else
+				wb->wb_error = 1;
+			if (fclose(fp) != 0) {
+				warn("fclose");
+				wb->wb_error = 1;
+			}
+		}
+
+		pthread_mutex_lock(&ld->ld_mtx);
+		wb->wb_done = 1;
+		pthread_cond_broadcast(&ld->ld_cond);
+	}
+	pthread_mutex_unlock(&ld->ld_mtx);
+
+	return NULL;
+}
+
+/*
+ * Dump the files in a pipeline: the loader thread maps and relocates the
+ * ELF images and scans their units, the workers of dump_units() format
+ * the units and the main thread writes them.
+ */
+int
+dump_pipeline(struct loader *ld, uint8_t flags, int *errorp)
+{
+	struct plimage		*pi;
+	int			 error = 0;
+
+	if (pthread_create(&ld->ld_thread, NULL, pl_load, ld) != 0)
+		return -1;
+
+	for (;;) {
+		pthread_mutex_lock(&ld->ld_mtx);
+		if (SIMPLEQ_EMPTY(&ld->ld_images) && !ld->ld_loaded)
+			ld->ld_loadq.lq_nempty++;
+		while (SIMPLEQ_EMPTY(&ld->ld_images) && !ld->ld_loaded)
+			pthread_cond_wait(&ld->ld_cond, &ld->ld_mtx);
+		pi = SIMPLEQ_FIRST(&ld->ld_images);
+		if (pi != NULL) {
+			pl_depth(&ld->ld_loadq, ld->ld_nimages);
+			SIMPLEQ_REMOVE_HEAD(&ld->ld_images, pi_next);
+			ld->ld_nimages--;
+			pthread_cond_broadcast(&ld->ld_cond);
+		}
+		pthread_mutex_unlock(&ld->ld_mtx);
+		if (pi == NULL)
+			break;
+
+		if (pi->pi_member != NULL)
+			printf("%s(%s):\n\n", pi->pi_path, pi->pi_member);
+		error |= pi->pi_error;
+		if (pi->pi_esi != NULL) {
+			if (!pi->pi_error)
+				error |= dwarf_format(stdout, pi->pi_ops,
+				    pi->pi_esi, &pi->pi_ds, &ld->ld_parseq,
+				    flags);
+			dw_cutab_purge(&pi->pi_ds.ds_dct);
+			pi->pi_ops->eo_secidx_free(pi->pi_esi);
+		}
+		free(pi->pi_member);
+		free(pi);
+	}
+
+	pthread_join(ld->ld_thread, NULL);
+
+	if (vflag) {
+		pl_stats("load", &ld->ld_loadq);
+		pl_stats("parse", &ld->ld_parseq);
+	}
+
+	*errorp = error;
+	return 0;
+}
+
+/*
+ * Loader stage of dump_pipeline(), load the ELF images of the files in
+ * order, archive members included.  A file is closed once its images
+ * are loaded, the mappings of their sections stay valid.
+ */
+void *
+pl_load(void *arg)
+{
+	struct loader		*ld = arg;
+	struct ldfile		*lf;
+	struct arreader		 arr;
+	struct plimage		*pi;
+	char			*buf;
+	size_t			 i;
+	int			 msb, rv;
+
+	/* Without a buffer, the sections are not prefetched. */
+	buf = malloc(LOAD_CHUNK);
+
+	for (i = 0; i < ld->ld_nfiles; i++) {
+		lf = &ld->ld_files[i];
+		if (ld_open(lf) != 0) {
+			pi = pl_image(lf->lf_path, NULL);
+			pi->pi_error = 1;
+			pl_push(ld, pi, -1, 0, NULL);
+			continue;
+		}
+
+		if (!lf->lf_isar) {
+			pi = pl_image(lf->lf_path, NULL);
+			pi->pi_ops = lf->lf_ops;
+			pi->pi_esi = lf->lf_esi;
+			pl_push(ld, pi, lf->lf_fd, lf->lf_msb, buf);
+		} else {
+			ar_init(&arr, lf->lf_path, lf->lf_fd, lf->lf_size);
+			while ((rv = ar_next(&arr)) == 0) {
+				pi = pl_image(lf->lf_path, arr.arr_name);
+				pi->pi_esi = elf_index(lf->lf_fd, arr.arr_off,
+				    arr.arr_len, &pi->pi_ops, &msb);
+				if (pi->pi_esi == NULL)
+					pi->pi_error = 1;
+				pl_push(ld, pi, lf->lf_fd, msb, buf);
+			}
+			ar_free(&arr);
+			if (rv == -1) {
+				pi = pl_image(lf->lf_path, NULL);
+				pi->pi_error = 1;
+				pl_push(ld, pi, -1, 0, NULL);
+			}
+		}
+
+		close(lf->lf_fd);
+		lf->lf_fd = -1;
+	}
+
+	pthread_mutex_lock(&ld->ld_mtx);
+	ld->ld_loaded = 1;
+	pthread_cond_broadcast(&ld->ld_cond);
+	pthread_mutex_unlock(&ld->ld_mtx);
+
+	free(buf);
+	return NULL;
+}
+
+struct plimage *
+pl_image(const char *path, const char *member)
+{
+	struct plimage		*pi;
+
+	pi = calloc(1, sizeof(*pi));
+	if (pi == NULL)
+		err(1, NULL);
+	pi->pi_path = path;
+	if (member != NULL && (pi->pi_member = strdup(member)) == NULL)
+		err(1, NULL);
+	dw_cutab_init(&pi->pi_ds.ds_dct);
+
+	return pi;
+}
+
+/*
+ * Wait for room in the queue of loaded images, load the image ``pi''
+ * of ``fd'' if it could be indexed and queue it.
+ */
+void
+pl_push(struct loader *ld, struct plimage *pi, int fd, int msb, char *buf)
+{
+	pthread_mutex_lock(&ld->ld_mtx);
+	if (ld->ld_nimages >= IMAGE_AHEAD)
+		ld->ld_loadq.lq_nfull++;
+	while (ld->ld_nimages >= IMAGE_AHEAD)
+		pthread_cond_wait(&ld->ld_cond, &ld->ld_mtx);
+	pthread_mutex_unlock(&ld->ld_mtx);
+
+	if (pi->pi_esi != NULL) {
+		if (buf != NULL)
+			ld_prefetch(pi->pi_ops, pi->pi_esi, fd, buf);
+		if (dwarf_load(pi->pi_ops, pi->pi_esi, msb, ld->ld_flags,
+		    &pi->pi_ds) != 0)
+			pi->pi_error = 1;
+	}
+
+	pthread_mutex_lock(&ld->ld_mtx);
+	SIMPLEQ_INSERT_TAIL(&ld->ld_images, pi, pi_next);
+	ld->ld_nimages++;
+	pthread_cond_broadcast(&ld->ld_cond);
+	pthread_mutex_unlock(&ld->ld_mtx);
+}
+
+/* Record the depth of a queue when an entry is taken from it. */
+void
+pl_depth(struct ldqueue *lq, size_t depth)
+{
+	if (depth > lq->lq_maxdepth)
+		lq->lq_maxdepth = depth;
+	lq->lq_nsamples++;
+	lq->lq_sumdepth += depth;
+}
+
+/* Add the use of the queue ``from'' to ``lq''. */
+void
+pl_merge(struct ldqueue *lq, const struct ldqueue *from)
+{
+	if (from->lq_maxdepth > lq->lq_maxdepth)
+		lq->lq_maxdepth = from->lq_maxdepth;
+	lq->lq_nsamples += from->lq_nsamples;
+	lq->lq_sumdepth += from->lq_sumdepth;
+	lq->lq_nfull += from->lq_nfull;
+	lq->lq_nempty += from->lq_nempty;
+}
+
+void
+pl_stats(const char *name, struct ldqueue *lq)
+{
+	fprintf(stderr, "%s queue: depth %.1f mean, %zu max, %llu stalls "
+	    "full, %llu stalls empty\n", name, (lq->lq_nsamples > 0) ?
+	    (double)lq->lq_sumdepth / lq->lq_nsamples : 0.0,
+	    lq->lq_maxdepth, lq->lq_nfull, lq->lq_nempty);
+}
+
+void *
+ld_main(void *arg)
+{
+	struct loader		*ld = arg;
+	struct ldfile		*lf;
+	char			*buf;
+	size_t			 i;
+
+	/* Without a buffer, files are still opened and indexed. */
+	buf = malloc(LOAD_CHUNK);
+
+	for (i = 0; i < ld->ld_nfiles; i++) {
+		pthread_mutex_lock(&ld->ld_mtx);
+		if (i >= ld->ld_ndumped + LOAD_AHEAD)
+			ld->ld_loadq.lq_nfull++;
+		while (i >= ld->ld_ndumped + LOAD_AHEAD)
+			pthread_cond_wait(&ld->ld_cond, &ld->ld_mtx);
+		pthread_mutex_unlock(&ld->ld_mtx);
+
+		lf = &ld->ld_files[i];
+		if (ld_open(lf) == 0 && buf != NULL)
+			ld_prefetch(lf->lf_ops, lf->lf_esi, lf->lf_fd, buf);
+
+		pthread_mutex_lock(&ld->ld_mtx);
+		ld->ld_nloaded = i + 1;
+		pthread_cond_broadcast(&ld->ld_cond);
+		pthread_mutex_unlock(&ld->ld_mtx);
+	}
+
+	free(buf);
+	return NULL;
+}
+
+/*
+ * Open a file and index it if it is not an archive.  On error a warning
+ * is printed and ``lf_fd'' is -1.
+ */
 int
-dump(const char *path, uint8_t flags)
+ld_open(struct ldfile *lf)
 {
 	struct stat		 st;
-	int			 fd, error = 1;
-	char			*p;
+	char			 magic[SARMAG];
+
+	lf->lf_isar = 0;
+	lf->lf_ops = NULL;
+	lf->lf_esi = NULL;
 
-	fd = open(path, O_RDONLY);
-	if (fd == -1) {
+	lf->lf_fd = open(lf->lf_path, O_RDONLY);
+	if (lf->lf_fd == -1) {
 		warn("open");
 		return 1;
 	}
-	if (fstat(fd, &st) == -1) {
+	if (fstat(lf->lf_fd, &st) == -1) {
 		warn("fstat");
-		close(fd);
-		return 1;
+		goto fail;
 	}
 	if ((uintmax_t)st.st_size > SIZE_MAX) {
 		warnx("file too big to fit memory");
-		close(fd);
-		return 1;
+		goto fail;
 	}
+	lf->lf_size = st.st_size;
 
-	p = mmap(NULL, st.st_size, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
-	if (p == MAP_FAILED)
-		err(1, "mmap");
+	if (lf->lf_size >= SARMAG && readat(lf->lf_fd, magic, SARMAG, 0) == 0 &&
+	    memcmp(magic, ARMAG, SARMAG) == 0) {
+		lf->lf_isar = 1;
+		return 0;
+	}
 
-	if (iself(p, st.st_size))
-		error = dwarf_dump(p, st.st_size, flags);
+	lf->lf_esi = elf_index(lf->lf_fd, 0, lf->lf_size, &lf->lf_ops,
+	    &lf->lf_msb);
+	if (lf->lf_esi == NULL)
+		goto fail;
 
-	munmap(p, st.st_size);
-	close(fd);
+	return 0;
+
+fail:
+	close(lf->lf_fd);
+	lf->lf_fd = -1;
+	return 1;
+}
+
+/* Sections read by dwarf_load(), with what relocating them needs. */
+const char *ld_sections[] = {
+	DEBUG_ABBREV, DEBUG_INFO, DEBUG_STR,
+	".rela" DEBUG_INFO, ".rel" DEBUG_INFO, ".symtab",
+};
+
+/*
+ * Read the sections of an indexed image of ``fd'' that will be dumped,
+ * so they are in the page cache when they are mapped.  Using pread(2)
+ * rather than faulting the pages in does not count against the RSS.
+ */
+void
+ld_prefetch(const struct elfops *ops, struct elfsecidx *esi, int fd,
+    char *buf)
+{
+	off_t			 off;
+	size_t			 i, size, n;
+
+	if (esi == NULL)
+		return;
+
+	for (i = 0; i < nitems(ld_sections); i++) {
+		if (ops->eo_getsecrange(esi, ld_sections[i], &off, &size) < 0)
+			continue;
+		for (; size > 0; size -= n, off += n) {
+			n = (size < LOAD_CHUNK) ? size : LOAD_CHUNK;
+			if (pread(fd, buf, n, off) != (ssize_t)n)
+				break;
+		}
+	}
+}
+
+/* Dump a file opened by ld_open() to ``fp'' and close it. */
+int
+dump_file(FILE *fp, struct ldfile *lf, uint8_t flags)
+{
+	int			 error;
+
+	if (lf->lf_isar)
+		error = dump_ar(fp, lf->lf_path, lf->lf_fd, lf->lf_size,
+		    flags);
+	else {
+		error = dwarf_dump(fp, lf->lf_ops, lf->lf_esi, lf->lf_msb,
+		    flags);
+		lf->lf_ops->eo_secidx_free(lf->lf_esi);
+	}
+
+	close(lf->lf_fd);
+	lf->lf_fd = -1;
+
+	return error;
+}
+
+/* Read exactly ``len'' bytes at offset ``off''. */
+int
+readat(int fd, void *buf, size_t len, off_t off)
+{
+	ssize_t			 n;
+
+	n = pread(fd, buf, len, off);
+	if (n == -1) {
+		warn("pread");
+		return -1;
+	}
+	if ((size_t)n != len)
+		return -1;
+
+	return 0;
+}
+
+/*
+ * Index the sections of the ELF image of ``size'' bytes at offset
+ * ``base'' of ``fd''.  The file is not mapped as a whole, only the
+ * sections that are read, see elf.c.
+ */
+struct elfsecidx *
+elf_index(int fd, off_t base, size_t size, const struct elfops **opsp,
+    int *msbp)
+{
+	const struct elfops	*ops;
+	char			 hdr[sizeof(Elf64_Ehdr)];
+	size_t			 hlen;
+
+	hlen = (size < sizeof(hdr)) ? size : sizeof(hdr);
+	if (readat(fd, hdr, hlen, base) != 0)
+		return NULL;
+
+	ops = elf_getops(hdr, size);
+	if (ops == NULL || !ops->eo_iself(hdr, size))
+		return NULL;
+
+	*opsp = ops;
+	*msbp = (hdr[EI_DATA] == ELFDATA2MSB);
+
+	return ops->eo_secidx_create(hdr, fd, base, size);
+}
+
+/* Dump the ELF image of ``size'' bytes at offset ``base'' of ``fd''. */
+int
+dump_elf(FILE *fp, int fd, off_t base, size_t size, uint8_t flags)
+{
+	const struct elfops	*ops;
+	struct elfsecidx	*esi;
+	int			 error, msb;
+
+	esi = elf_index(fd, base, size, &ops, &msb);
+	if (esi == NULL)
+		return 1;
+
+	error = dwarf_dump(fp, ops, esi, msb, flags);
+
+	ops->eo_secidx_free(esi);
 
 	return error;
 }
 
-const char		*dstrbuf;
-size_t			 dstrlen;
+/*
+ * Dump the ELF members of an ar(1) archive where they are in the file,
+ * without extracting them.
+ */
+int
+dump_ar(FILE *fp, const char *path, int fd, size_t filesize, uint8_t flags)
+{
+	struct arreader		 arr;
+	int			 error = 0, rv;
+
+	ar_init(&arr, path, fd, filesize);
+	while ((rv = ar_next(&arr)) == 0) {
+		fprintf(fp, "%s(%s):\n\n", path, arr.arr_name);
+		error |= dump_elf(fp, fd, arr.arr_off, arr.arr_len, flags);
+	}
+	ar_free(&arr);
+
+	return error | (rv == -1);
+}
+
+void
+ar_init(struct arreader *arr, const char *path, int fd, size_t filesize)
+{
+	memset(arr, 0, sizeof(*arr));
+	arr->arr_path = path;
+	arr->arr_fd = fd;
+	arr->arr_size = filesize;
+	arr->arr_next = SARMAG;
+}
 
+/*
+ * Find the next ELF member of the archive, its name, offset and size are
+ * left in ``arr''.  Return 0 if there is one, 1 at the end of the
+ * archive or -1 after reporting an error.
+ */
 int
-dwarf_dump(char *p, size_t filesize, uint8_t flags)
+ar_next(struct arreader *arr)
 {
-	const char		*shstab, *infobuf, *abbuf;
-	size_t			 infolen, ablen;
-	size_t			 shstabsz;
+	struct ar_hdr		 ah;
+	char			 magic[SELFMAG];
+	const char		*path = arr->arr_path;
+	size_t			 off, size, skip, filesize = arr->arr_size;
+	int			 fd = arr->arr_fd;
+
+	while ((off = arr->arr_next) < filesize) {
+		if (filesize - off < sizeof(ah) ||
+		    readat(fd, &ah, sizeof(ah), off) != 0) {
+			warnx("%s: truncated archive", path);
+			return -1;
+		}
+		if (memcmp(ah.ar_fmag, ARFMAG, sizeof(ah.ar_fmag)) != 0 ||
+		    ar_getnum(ah.ar_size, sizeof(ah.ar_size), &size) != 0) {
+			warnx("%s: bad archive header at 0x%zx", path, off);
+			return -1;
+		}
+		off += sizeof(ah);
+		if (size > filesize - off) {
+			warnx("%s: truncated archive", path);
+			return -1;
+		}
+		/* Members are aligned on 2 bytes. */
+		arr->arr_next = off + size + (size & 1);
+
+		/* The GNU table of long names. */
+		if (strncmp(ah.ar_name, "// ", 3) == 0) {
+			free(arr->arr_strtab);
+			arr->arr_strtab = malloc(size);
+			if (arr->arr_strtab == NULL)
+				err(1, NULL);
+			if (readat(fd, arr->arr_strtab, size, off) != 0) {
+				warnx("%s: truncated archive", path);
+				return -1;
+			}
+			arr->arr_strtablen = size;
+			continue;
+		}
+
+		if (ar_getname(&ah, fd, off, size, arr->arr_strtab,
+		    arr->arr_strtablen, arr->arr_name, sizeof(arr->arr_name),
+		    &skip) != 0) {
+			warnx("%s: bad member name at 0x%zx", path,
+			    off - sizeof(ah));
+			return -1;
+		}
+		off += skip;
+		size -= skip;
 
-	/* Find section header string table location and size. */
-	if (elf_getshstab(p, filesize, &shstab, &shstabsz))
+		/* Skip symbol tables and anything else that is not ELF. */
+		if (size < SELFMAG || readat(fd, magic, SELFMAG, off) != 0 ||
+		    memcmp(magic, ELFMAG, SELFMAG) != 0)
+			continue;
+
+		arr->arr_off = off;
+		arr->arr_len = size;
+		return 0;
+	}
+
+	return 1;
+}
+
+void
+ar_free(struct arreader *arr)
+{
+	free(arr->arr_strtab);
+	arr->arr_strtab = NULL;
+}
+
+/* Parse a decimal field of an archive header, padded with spaces. */
+int
+ar_getnum(const char *s, size_t len, size_t *v)
+{
+	size_t	 i, n = 0;
+
+	for (i = 0; i < len && s[i] >= '0' && s[i] <= '9'; i++) {
+		if (n > (SIZE_MAX - 9) / 10)
+			return -1;
+		n = n * 10 + (s[i] - '0');
+	}
+	if (i == 0)
+		return -1;
+	for (; i < len; i++) {
+		if (s[i] != ' ')
+			return -1;
+	}
+
+	*v = n;
+	return 0;
+}
+
+/*
+ * Copy the name of the archive member at offset ``off'' in ``name''.
+ * BSD long names are stored at the beginning of the member, their size
+ * is returned in ``skipp''.  GNU long names are in the ``strtab''
+ * member.
+ */
+int
+ar_getname(const struct ar_hdr *ah, int fd, size_t off, size_t size,
+    const char *strtab, size_t strtablen, char *name, size_t namesz,
+    size_t *skipp)
+{
+	const char	*s = ah->ar_name, *end;
+	size_t		 len = sizeof(ah->ar_name), soff;
+
+	*skipp = 0;
+
+	if (strncmp(s, "#1/", 3) == 0) {
+		if (ar_getnum(s + 3, len - 3, &len) != 0 || len > size)
+			return -1;
+		*skipp = len;
+		if (len >= namesz)
+			len = namesz - 1;
+		/* The name may be padded with NULs. */
+		if (readat(fd, name, len, off) != 0)
+			return -1;
+		name[len] = '\0';
+		return 0;
+	}
+
+	if (s[0] == '/' && s[1] >= '0' && s[1] <= '9') {
+		if (ar_getnum(s + 1, len - 1, &soff) != 0 ||
+		    soff >= strtablen)
+			return -1;
+		s = strtab + soff;
+		end = memchr(s, '\n', strtablen - soff);
+		if (end == NULL)
+			return -1;
+		len = end - s;
+		if (len > 0 && s[len - 1] == '/')
+			len--;
+	} else {
+		/* GNU names end with a slash, BSD ones are padded. */
+		end = memchr(s, '/', len);
+		if (end != NULL && end != s)
+			len = end - s;
+		while (len > 0 && s[len - 1] == ' ')
+			len--;
+	}
+
+	if (len >= namesz)
+		len = namesz - 1;
+	memcpy(name, s, len);
+	name[len] = '\0';
+
+	return 0;
+}
+
+/* Select the ELF reader matching the class of the file. */
+const struct elfops *
+elf_getops(const char *p, size_t filesize)
+{
+	if (filesize < EI_NIDENT || memcmp(p, ELFMAG, SELFMAG) != 0)
+		return NULL;
+
+	switch (p[EI_CLASS]) {
+	case ELFCLASS32:
+		return &elf32_ops;
+	case ELFCLASS64:
+		return &elf64_ops;
+	default:
+		warnx("unexpected word size %u", p[EI_CLASS]);
+		return NULL;
+	}
+}
+
+/*
+ * Report a section that could not be read, the cause of a mapping or
+ * relocation failure has been reported when it happened.
+ */
+void
+secwarn(const char *sname, ssize_t idx)
+{
+	if (idx == -1)
+		warnx("%s section not found", sname);
+	else
+		warnx("%s section could not be mapped or relocated", sname);
+}
+
+/* Dump the debug sections of an ELF image. */
+int
+dwarf_dump(FILE *fp, const struct elfops *ops, struct elfsecidx *esi,
+    int msb, uint8_t flags)
+{
+	struct dwsecs		 ds;
+	int			 error;
+
+	if (dwarf_load(ops, esi, msb, flags, &ds) != 0)
 		return 1;
 
+	error = dwarf_format(fp, ops, esi, &ds, NULL, flags);
+	dw_cutab_purge(&ds.ds_dct);
+
+	return error;
+}
+
+/*
+ * Map the sections of an ELF image read by dwarf_format(), applying the
+ * relocations of .debug_info unless -r is given.  Its units are scanned
+ * if they are looked up by dump_seek() or formatted by dump_units().
+ * Return 1 if the image cannot be dumped.
+ */
+int
+dwarf_load(const struct elfops *ops, struct elfsecidx *esi, int msb,
+    uint8_t flags, struct dwsecs *ds)
+{
+	ssize_t			 idx;
+
+	memset(ds, 0, sizeof(*ds));
+	dw_cutab_init(&ds->ds_dct);
+
+	/* DWARF data is in the byte order of the file. */
+	if (msb)
+		ds->ds_cuflags |= DW_CU_MSB;
+
 	/* Find abbreviation location and size. */
-	if (elf_getsection(p, filesize, DEBUG_ABBREV, shstab, shstabsz, &abbuf,
-	    &ablen) == -1) {
-		warnx("%s section not found", DEBUG_ABBREV);
+	idx = ops->eo_getsection(esi, DEBUG_ABBREV, &ds->ds_abbrev.buf,
+	    &ds->ds_abbrev.len);
+	if (idx < 0) {
+		secwarn(DEBUG_ABBREV, idx);
 		return 1;
 	}
-
-	if (elf_getsection(p, filesize, DEBUG_INFO, shstab, shstabsz, &infobuf,
-	    &infolen) == -1) {
-		warnx("%s section not found", DEBUG_INFO);
+	ops->eo_advise(esi, ds->ds_abbrev.buf, ds->ds_abbrev.len,
+	    MADV_WILLNEED);
+
+	if (rflag)
+		idx = ops->eo_getsection_lazy(esi, DEBUG_INFO,
+		    &ds->ds_info.buf, &ds->ds_info.len, &ds->ds_drs);
+	else
+		idx = ops->eo_getsection(esi, DEBUG_INFO, &ds->ds_info.buf,
+		    &ds->ds_info.len);
+	if (idx < 0) {
+		secwarn(DEBUG_INFO, idx);
 		return 1;
 	}
+	ops->eo_advise(esi, ds->ds_info.buf, ds->ds_info.len, MADV_SEQUENTIAL);
 
 	/* Find string table location and size. */
-	if (elf_getsection(p, filesize, DEBUG_STR, shstab, shstabsz, &dstrbuf,
-	    &dstrlen) == -1)
-		warnx("%s section not found", DEBUG_STR);
+	idx = ops->eo_getsection(esi, DEBUG_STR, &ds->ds_str.buf,
+	    &ds->ds_str.len);
+	if (idx < 0)
+		secwarn(DEBUG_STR, idx);
+	else
+		ops->eo_advise(esi, ds->ds_str.buf, ds->ds_str.len,
+		    MADV_WILLNEED);
+
+	/* On error the table has the valid units preceding it. */
+	if ((flags & DUMP_INFO) && (cflag || oflag || cujobs > 1 || pflag))
+		dw_cutab_scan(&ds->ds_info, DS_RELOCS(ds), ds->ds_cuflags,
+		    &ds->ds_dct);
+
+	return 0;
+}
 
+/*
+ * Dump the sections of an image loaded by dwarf_load().  With worker
+ * threads, the use of the queue of formatted units is added to ``lq''
+ * if it is not NULL.
+ */
+int
+dwarf_format(FILE *fp, const struct elfops *ops, struct elfsecidx *esi,
+    struct dwsecs *ds, struct ldqueue *lq, uint8_t flags)
+{
+	int			 error, rv = 0;
 
 	if (flags & DUMP_ABBREV) {
-		struct dwbuf	 abbrev = { .buf = abbuf, .len = ablen };
-		struct dwabbrev_queue dabq = SIMPLEQ_HEAD_INITIALIZER(dabq);
+		struct dwbuf	 abbrev = ds->ds_abbrev;
+		struct dwarena	 dar;
+		struct dwabtab	 dbt;
+
+		dw_arena_init(&dar);
+		dw_abtab_init(&dbt);
 
-		printf("Contents of the %s section:\n\n", DEBUG_ABBREV);
-		while (dw_ab_parse(&abbrev, &dabq) == 0) {
+		fprintf(fp, "Contents of the %s section:\n\n", DEBUG_ABBREV);
+		while (dw_ab_parse(&abbrev, &dar, &dbt) == 0) {
 			struct dwabbrev *dab;
 
- 			printf("  Number TAG\n");
-			SIMPLEQ_FOREACH(dab, &dabq, dab_next) {
+ 			fprintf(fp, "  Number TAG\n");
+			SIMPLEQ_FOREACH(dab, &dbt.dbt_abbrevs, dab_next) {
 				struct dwattr *dat;
 
-				printf("   %llu      %s    [%s children]\n",
+				fprintf(fp,
+				    "   %llu      %s    [%s children]\n",
 				    dab->dab_code, dw_tag2name(dab->dab_tag),
 				    (dab->dab_children) ? "has" : "no");
 
 				SIMPLEQ_FOREACH(dat, &dab->dab_attrs, dat_next){
-					printf("    %-18s %s\n",
+					fprintf(fp, "    %-18s %s\n",
 					    dw_at2name(dat->dat_attr),
 					    dw_form2name(dat->dat_form));
 				}
 			}
 
-			dw_dabq_purge(&dabq);
+			dw_arena_reset(&dar);
+			dw_abtab_init(&dbt);
 		}
 
+		dw_arena_purge(&dar);
+
 	}
 
 	if (flags & DUMP_INFO) {
-		struct dwbuf	 info = { .buf = infobuf, .len = infolen };
-		struct dwbuf	 abbrev = { .buf = abbuf, .len = ablen };
+		struct dwbuf	 info = ds->ds_info;
+		struct dwbuf	 abbrev = ds->ds_abbrev;
+		const struct dwrelocs *pdrs = DS_RELOCS(ds);
+		struct dwabcache dac;
+		struct dwarena	 dar;
 		struct dwcu	*dcu = NULL;
+		const char	*done = info.buf;
+
+		dw_abcache_init(&dac);
+		dw_arena_init(&dar);
+
+		/* Jump to the only unit to dump. */
+		if (cflag || oflag) {
+			error = dump_seek(&info, &ds->ds_dct);
+			if (error != 0) {
+				info.len = 0;
+				rv = 1;
+			}
+		}
+
+		fprintf(fp, "The section %s contains:\n\n", DEBUG_INFO);
 
-		printf("The section %s contains:\n\n", DEBUG_INFO);
-		while (dw_cu_parse(&info, &abbrev, infolen, &dcu) == 0) {
-			dump_cu(dcu);
+		/* Without worker threads, fall back to the serial walk. */
+		if ((cujobs > 1 || pflag) && !cflag && !oflag &&
+		    dump_units(fp, ops, esi, ds, &dac, lq) == 0)
+			info.len = 0;
+
+		while (dw_cu_walk(&info, &abbrev, ds->ds_info.len, pdrs, &dac,
+		    &dar, ds->ds_cuflags, &dcu) == 0) {
+			error = dump_cu(fp, dcu, SIZE_MAX, &ds->ds_str);
 			dw_dcu_free(dcu);
+			if (error != 0 || cflag || oflag)
+				break;
+
+			/* Units are read once, keep the RSS bounded. */
+			if (info.buf - done >= INFO_RELEASE_SIZE) {
+				ops->eo_advise(esi, done, info.buf - done,
+				    MADV_DONTNEED);
+				done = info.buf;
+			}
 		}
+
+		if (vflag)
+			fprintf(stderr, "abbrev cache: %llu hits, %llu misses\n",
+			    dac.dac_hits, dac.dac_misses);
+
+		dw_abcache_purge(&dac);
+		dw_arena_purge(&dar);
+	}
+
+	return rv;
+}
+
+/*
+ * Position ``info'' at the beginning of the unit selected with -c or -o
+ * using the table of the unit headers ``dct'', no DIE of the preceding
+ * units is parsed.
+ */
+int
+dump_seek(struct dwbuf *info, struct dwcutab *dct)
+{
+	struct dwcuent	*dce = NULL;
+
+	if (vflag)
+		fprintf(stderr, "unit table: %zu units\n", dct->dct_nunits);
+
+	if (cflag && cuindex < dct->dct_nunits)
+		dce = &dct->dct_units[cuindex];
+	else if (oflag)
+		dce = dw_cutab_find(dct, cuoffset);
+
+	if (dce == NULL) {
+		if (cflag)
+			warnx("no unit with index %zu", cuindex);
+		else
+			warnx("no unit at offset 0x%zx", cuoffset);
+		return ENOENT;
 	}
 
+	info->buf += dce->dce_offset;
+	info->len -= dce->dce_offset;
+
 	return 0;
 }
 
+/*
+ * Dump all the units of the loaded image ``ds'' with ``cujobs'' worker
+ * threads, at least one.  The abbreviation tables are parsed beforehand
+ * so the cache can be shared.
+ */
 int
-dump_cu(struct dwcu *dcu)
+dump_units(FILE *fp, const struct elfops *ops, struct elfsecidx *esi,
+    struct dwsecs *ds, struct dwabcache *dac, struct ldqueue *lq)
+{
+	struct cupool		 cp;
+	struct cuout		*co;
+	struct cutask		*ct, *nct;
+	struct dwcuent		*dce;
+	struct dwabtab		*dbt;
+	pthread_t		*threads;
+	const struct dwbuf	*info = &ds->ds_info;
+	const char		*done = info->buf, *next;
+	size_t			 i, nunits, nthreads = 0;
+	int			 error = 0, waited;
+
+	cp.cp_dct = &ds->ds_dct;
+	nunits = cp.cp_dct->dct_nunits;
+	threads = calloc(cujobs, sizeof(*threads));
+	cp.cp_outs = calloc(nunits + 1, sizeof(*cp.cp_outs));
+	if (threads == NULL || cp.cp_outs == NULL)
+		err(1, NULL);
+
+	for (i = 0; i < nunits; i++) {
+		co = &cp.cp_outs[i];
+		co->co_first.ct_unit = i;
+		co->co_first.ct_end = SIZE_MAX;
+		SIMPLEQ_INIT(&co->co_parts);
+		SIMPLEQ_INSERT_TAIL(&co->co_parts, &co->co_first, ct_link);
+	}
+
+	cp.cp_info = *info;
+	cp.cp_abbrev = ds->ds_abbrev;
+	cp.cp_drs = DS_RELOCS(ds);
+	cp.cp_dac = dac;
+	cp.cp_dstr = &ds->ds_str;
+	cp.cp_cuflags = ds->ds_cuflags;
+	SIMPLEQ_INIT(&cp.cp_tasks);
+	cp.cp_nsplitting = 0;
+	cp.cp_window = CU_WINDOW(cujobs);
+	cp.cp_next = cp.cp_nwritten = 0;
+	cp.cp_nbuffered = 0;
+	memset(&cp.cp_queue, 0, sizeof(cp.cp_queue));
+	cp.cp_stop = 0;
+	pthread_mutex_init(&cp.cp_mtx, NULL);
+	pthread_cond_init(&cp.cp_cond, NULL);
+
+	/* Workers wait until the cache is filled. */
+	pthread_mutex_lock(&cp.cp_mtx);
+	for (nthreads = 0; nthreads < (size_t)cujobs; nthreads++) {
+		if (pthread_create(&threads[nthreads], NULL, cu_worker,
+		    &cp) != 0)
+			break;
+	}
+	if (nthreads == 0) {
+		pthread_mutex_unlock(&cp.cp_mtx);
+		goto out;
+	}
+
+	/*
+	 * Parse the tables in the order of the units, as the serial walk
+	 * does, up to the first unit it would fail on.
+	 */
+	for (i = 0; i < nunits; i++) {
+		dce = &cp.cp_dct->dct_units[i];
+		if (dce->dce_version != 2 ||
+		    dce->dce_abbroff > cp.cp_abbrev.len ||
+		    dw_abcache_get(dac, &cp.cp_abbrev, dce->dce_abbroff,
+		    &dbt) != 0)
+			break;
+	}
+	dw_abcache_freeze(dac);
+	pthread_cond_broadcast(&cp.cp_cond);
+	pthread_mutex_unlock(&cp.cp_mtx);
+
+	for (i = 0; i < nunits && error == 0; i++) {
+		co = &cp.cp_outs[i];
+
+		/* Units started and not written, this one included. */
+		pthread_mutex_lock(&cp.cp_mtx);
+		pl_depth(&cp.cp_queue, cp.cp_next - i);
+		pthread_mutex_unlock(&cp.cp_mtx);
+
+		/*
+		 * Parts are written while the unit is being split, the unit
+		 * is written with its last one.
+		 */
+		for (ct = &co->co_first; ct != NULL; ct = nct) {
+			waited = wb_write(fp, &ct->ct_out, &cp.cp_mtx,
+			    &cp.cp_cond, NULL, 0);
+
+			error = ct->ct_out.wb_error;
+			if (error != 0)
+				break;
+
+			pthread_mutex_lock(&cp.cp_mtx);
+			cp.cp_nbuffered -= ct->ct_out.wb_len;
+			nct = SIMPLEQ_NEXT(ct, ct_link);
+			if (nct == NULL && !co->co_split)
+				waited = 1;
+			while ((nct = SIMPLEQ_NEXT(ct, ct_link)) == NULL &&
+			    !co->co_split)
+				pthread_cond_wait(&cp.cp_cond, &cp.cp_mtx);
+			if (nct == NULL)
+				cp.cp_nwritten = i + 1;
+			pthread_cond_broadcast(&cp.cp_cond);
+			pthread_mutex_unlock(&cp.cp_mtx);
+
+			if (waited)
+				cp.cp_queue.lq_nempty++;
+		}
+
+		/* Units are read once, keep the RSS bounded. */
+		if (i + 1 < nunits)
+			next = info->buf +
+			    cp.cp_dct->dct_units[i + 1].dce_offset;
+		else
+			next = info->buf + info->len;
+		if (error == 0 && next - done >= INFO_RELEASE_SIZE) {
+			ops->eo_advise(esi, done, next - done, MADV_DONTNEED);
+			done = next;
+		}
+	}
+
+	pthread_mutex_lock(&cp.cp_mtx);
+	cp.cp_stop = 1;
+	pthread_cond_broadcast(&cp.cp_cond);
+	pthread_mutex_unlock(&cp.cp_mtx);
+
+	for (i = 0; i < nthreads; i++)
+		pthread_join(threads[i], NULL);
+
+	if (lq != NULL)
+		pl_merge(lq, &cp.cp_queue);
+
+	/* Parts formatted after an error. */
+	for (i = 0; i < nunits; i++) {
+		co = &cp.cp_outs[i];
+		while ((ct = SIMPLEQ_FIRST(&co->co_parts)) != NULL) {
+			SIMPLEQ_REMOVE_HEAD(&co->co_parts, ct_link);
+			free(ct->ct_out.wb_buf);
+			if (ct != &co->co_first)
+				free(ct);
+		}
+	}
+out:
+	pthread_cond_destroy(&cp.cp_cond);
+	pthread_mutex_destroy(&cp.cp_mtx);
+	free(cp.cp_outs);
+	free(threads);
+
+	return (nthreads == 0) ? -1 : 0;
+}
+
+/*
+ * Whether a worker can start the next unit: it must be in the window,
+ * and the output waiting to be written must fit CU_BUFFERED unless all
+ * the previous units are written.
+ */
+int
+cu_room(struct cupool *cp)
+{
+	if (cp->cp_next >= cp->cp_nwritten + cp->cp_window)
+		return 0;
+
+	return cp->cp_next == cp->cp_nwritten ||
+	    cp->cp_nbuffered < CU_BUFFERED;
+}
+
+/*
+ * Format parts of split units first, they are needed before the next
+ * units.  Idle workers thus help the one formatting a big unit.
+ */
+void *
+cu_worker(void *arg)
+{
+	struct cupool		*cp = arg;
+	struct cuout		*co;
+	struct cutask		*ct;
+	struct dwarena		 dar;
+	size_t			 i, nunits = cp->cp_dct->dct_nunits;
+
+	dw_arena_init(&dar);
+
+	pthread_mutex_lock(&cp->cp_mtx);
+	for (;;) {
+		if (!cp->cp_stop && SIMPLEQ_EMPTY(&cp->cp_tasks) &&
+		    cp->cp_next < nunits && !cu_room(cp))
+			cp->cp_queue.lq_nfull++;
+		while (!cp->cp_stop && SIMPLEQ_EMPTY(&cp->cp_tasks) &&
+		    (cp->cp_next < nunits || cp->cp_nsplitting > 0) &&
+		    (cp->cp_next >= nunits || !cu_room(cp)))
+			pthread_cond_wait(&cp->cp_cond, &cp->cp_mtx);
+		if (cp->cp_stop)
+			break;
+
+		if ((ct = SIMPLEQ_FIRST(&cp->cp_tasks)) != NULL) {
+			SIMPLEQ_REMOVE_HEAD(&cp->cp_tasks, ct_next);
+		} else if (cp->cp_next < nunits) {
+			i = cp->cp_next++;
+			co = &cp->cp_outs[i];
+			ct = &co->co_first;
+			if (cp->cp_dct->dct_units[i].dce_length >=
+			    CU_SPLIT_SIZE) {
+				cp->cp_nsplitting++;
+				pthread_mutex_unlock(&cp->cp_mtx);
+				if (cu_split(cp, i, &dar))
+					ct = NULL;
+				pthread_mutex_lock(&cp->cp_mtx);
+				cp->cp_nsplitting--;
+			}
+			co->co_split = 1;
+			pthread_cond_broadcast(&cp->cp_cond);
+
+			/* All the parts were queued. */
+			if (ct == NULL)
+				continue;
+		} else
+			break;
+		pthread_mutex_unlock(&cp->cp_mtx);
+
+		cu_format(cp, ct, &dar);
+
+		pthread_mutex_lock(&cp->cp_mtx);
+		ct->ct_out.wb_done = 1;
+		cp->cp_nbuffered += ct->ct_out.wb_len;
+		pthread_cond_broadcast(&cp->cp_cond);
+	}
+	pthread_mutex_unlock(&cp->cp_mtx);
+
+	dw_arena_purge(&dar);
+	return NULL;
+}
+
+/*
+ * Split the unit number ``i'' at the top-level DIEs following every
+ * CU_SPLIT_SIZE bytes.  Parts are queued as soon as their end is found,
+ * the first one included, so they are formatted and written while the
+ * rest of the unit is walked.  If the unit cannot be walked, the last
+ * part ends with it, its error is reported when it is formatted.
+ * Return 0 if the unit is not split, the first part is then left to
+ * the caller.
+ */
+int
+cu_split(struct cupool *cp, size_t i, struct dwarena *dar)
+{
+	struct cuout		*co = &cp->cp_outs[i];
+	struct cutask		*ct, *last = &co->co_first;
+	struct dwbuf		 info = cp->cp_info;
+	struct dwbuf		 abbrev = cp->cp_abbrev;
+	struct dwcu		*dcu;
+	struct dwdie		*die;
+	size_t			 off = cp->cp_dct->dct_units[i].dce_offset;
+	size_t			 start = off;
+
+	info.buf += off;
+	info.len -= off;
+	if (dw_cu_walk(&info, &abbrev, cp->cp_info.len, cp->cp_drs,
+	    cp->cp_dac, dar, cp->cp_cuflags | DW_CU_LAZY, &dcu) != 0)
+		return 0;
+
+	while (dw_die_next(dcu, &die) == 0 && die != NULL) {
+		if (die->die_lvl <= 1 &&
+		    die->die_offset - start >= CU_SPLIT_SIZE) {
+			ct = calloc(1, sizeof(*ct));
+			if (ct == NULL)
+				break;
+			ct->ct_unit = i;
+			ct->ct_start = start = die->die_offset;
+			ct->ct_end = SIZE_MAX;
+			ct->ct_lvl = die->die_lvl;
+
+			pthread_mutex_lock(&cp->cp_mtx);
+			last->ct_end = ct->ct_start;
+			SIMPLEQ_INSERT_TAIL(&cp->cp_tasks, last, ct_next);
+			SIMPLEQ_INSERT_TAIL(&co->co_parts, ct, ct_link);
+			pthread_cond_broadcast(&cp->cp_cond);
+			pthread_mutex_unlock(&cp->cp_mtx);
+			last = ct;
+		}
+
+		/* Only the top-level DIEs are looked at. */
+		if (die->die_lvl > 0 && dw_die_skip_children(dcu, die) != 0)
+			break;
+	}
+
+	dw_dcu_free(dcu);
+
+	if (last == &co->co_first)
+		return 0;
+
+	pthread_mutex_lock(&cp->cp_mtx);
+	SIMPLEQ_INSERT_TAIL(&cp->cp_tasks, last, ct_next);
+	pthread_cond_broadcast(&cp->cp_cond);
+	pthread_mutex_unlock(&cp->cp_mtx);
+
+	return 1;
+}
+
+/* Format a part of a unit in its output buffer. */
+void
+cu_format(struct cupool *cp, struct cutask *ct, struct dwarena *dar)
+{
+	struct dwbuf		 info = cp->cp_info;
+	struct dwbuf		 abbrev = cp->cp_abbrev;
+	struct wrbuf		*wb = &ct->ct_out;
+	struct dwcu		*dcu;
+	FILE			*fp;
+	size_t			 off;
+
+	off = cp->cp_dct->dct_units[ct->ct_unit].dce_offset;
+	fp = open_memstream(&wb->wb_buf, &wb->wb_len);
+	if (fp == NULL) {
+		wb->wb_error = errno;
+		return;
+	}
+
+	info.buf += off;
+	info.len -= off;
+	wb->wb_error = dw_cu_walk(&info, &abbrev, cp->cp_info.len, cp->cp_drs,
+	    cp->cp_dac, dar, cp->cp_cuflags, &dcu);
+	if (wb->wb_error == 0) {
+		if (ct->ct_start == 0)
+			wb->wb_error = dump_cu(fp, dcu, ct->ct_end,
+			    cp->cp_dstr);
+		else if ((wb->wb_error = dw_die_seek(dcu, ct->ct_start,
+		    ct->ct_lvl)) == 0)
+			wb->wb_error = dump_dies(fp, dcu, ct->ct_end,
+			    cp->cp_dstr);
+		dw_dcu_free(dcu);
+	}
+
+	if (fclose(fp) != 0 && wb->wb_error == 0)
+		wb->wb_error = errno;
+}
+
+/* Dump the header of a unit and its DIEs preceding offset ``end''. */
+int
+dump_cu(FILE *fp, struct dwcu *dcu, size_t end, const struct dwbuf *dstr)
+{
+	fprintf(fp, "  Compilation Unit @ offset 0x%zx:\n", dcu->dcu_offset);
+	fprintf(fp, "   Length:        %llu\n", dcu->dcu_length);
+	fprintf(fp, "   Version:       %u\n", dcu->dcu_version);
+	fprintf(fp, "   Abbrev Offset: %llu\n", dcu->dcu_abbroff);
+	fprintf(fp, "   Pointer Size:  %u\n", dcu->dcu_psize);
+
+	return dump_dies(fp, dcu, end, dstr);
+}
+
+int
+dump_dies(FILE *fp, struct dwcu *dcu, size_t end, const struct dwbuf *dstr)
 {
 	struct dwdie *die;
 	struct dwaval *dav;
+	size_t i;
+	int error;
 
-	printf("  Compilation Unit @ offset 0x%zx:\n", dcu->dcu_offset);
-	printf("   Length:        %llu\n", dcu->dcu_length);
-	printf("   Version:       %u\n", dcu->dcu_version);
-	printf("   Abbrev Offset: %llu\n", dcu->dcu_abbroff);
-	printf("   Pointer Size:  %u\n", dcu->dcu_psize);
-
-	SIMPLEQ_FOREACH(die, &dcu->dcu_dies, die_next) {
-		printf(" <%u><%lx>: Abbrev Number: %lld (%s)\n", die->die_lvl,
-		    die->die_offset, die->die_dab->dab_code,
+	while ((error = dw_die_next(dcu, &die)) == 0 && die != NULL &&
+	    die->die_offset < end) {
+		fprintf(fp, " <%u><%lx>: Abbrev Number: %lld (%s)\n",
+		    die->die_lvl, die->die_offset, die->die_dab->dab_code,
 		    dw_tag2name(die->die_dab->dab_tag));
 
-		SIMPLEQ_FOREACH(dav, &die->die_avals, dav_next)
-			dump_dav(dav, dcu->dcu_psize, dcu->dcu_offset);
+		dav = DWCU_AVALS(dcu, die);
+		for (i = 0; i < die->die_dab->dab_nattrs; i++)
+			dump_dav(fp, &dav[i], dcu->dcu_psize,
+			    dcu->dcu_offset, dstr);
 	}
 
-	return 0;
+	return error;
 }
 
 void
-dump_dav(struct dwaval *dav, size_t psz, size_t offset)
+dump_dav(FILE *fp, struct dwaval *dav, size_t psz, size_t offset,
+    const struct dwbuf *dstr)
 {
 	uint64_t attr = dav->dav_dat->dat_attr;
 	uint64_t form = dav->dav_dat->dat_form;
@@ -262,12 +1774,12 @@ dump_dav(struct dwaval *dav, size_t psz, size_t offset)
 	uint64_t oper1;
 	uint8_t op;
 
-	printf("     %-18s: ", dw_at2name(attr));
+	fprintf(fp, "     %-18s: ", dw_at2name(attr));
 
 	val = dav2val(dav, psz);
-	str = dav2str(dav);
+	str = dav2str(dav, dstr);
 	if (val == (uint64_t)-1 && str == NULL) {
-		printf("%s: %llu\n", dw_form2name(form), form);
+		fprintf(fp, "%s: %llu\n", dw_form2name(form), form);
 		return;
 	}
 
@@ -277,14 +1789,15 @@ dump_dav(struct dwaval *dav, size_t psz, size_t offset)
 	case DW_AT_comp_dir:
 		switch (form) {
 		case DW_FORM_string:
-			printf("%s", str);
+			fprintf(fp, "%s", str);
 			break;
 		case DW_FORM_strp:
-			printf("(indirect string, offset:"
-			    " 0x%llx): %s", val, str);
+			fprintf(fp, "(indirect string, offset:"
+			    " 0x%llx): %s", val, (str != NULL) ? str :
+			    "<invalid offset>");
 			break;
 		default:
-			printf(" %s", dw_form2name(form));
+			fprintf(fp, " %s", dw_form2name(form));
 			break;
 		}
 		break;
@@ -299,22 +1812,22 @@ dump_dav(struct dwaval *dav, size_t psz, size_t offset)
 	case DW_AT_declaration:
 	case DW_AT_call_file:
 	case DW_AT_call_line:
-		printf("%llu", val);
+		fprintf(fp, "%llu", val);
 		break;
 	case DW_AT_inline:
-		printf("%llu\t(%s)", val, inline2name(val));
+		fprintf(fp, "%llu\t(%s)", val, inline2name(val));
 		break;
 	case DW_AT_stmt_list:
 	case DW_AT_low_pc:
 	case DW_AT_high_pc:
 	case DW_AT_ranges:
-		printf("0x%llx", val);
+		fprintf(fp, "0x%llx", val);
 		break;
 	case DW_AT_language:
-		printf("%llu\t(%s)", val, lang2name(val));
+		fprintf(fp, "%llu\t(%s)", val, lang2name(val));
 		break;
 	case DW_AT_encoding:
-		printf("%llu\t(%s)", val, enc2name(val));
+		fprintf(fp, "%llu\t(%s)", val, enc2name(val));
 		break;
 	case DW_AT_location:
 	case DW_AT_frame_base:
@@ -324,34 +1837,36 @@ dump_dav(struct dwaval *dav, size_t psz, size_t offset)
 		case DW_FORM_block2:
 		case DW_FORM_block4:
 		case DW_FORM_block:
-			printf("%zu byte block:", dav->dav_buf.len);
+			fprintf(fp, "%zu byte block:", dav->dav_buf.len);
 			for (i = 0; i < dav->dav_buf.len; i++)
-				printf(" %x", (uint8_t)dav->dav_buf.buf[i]);
+				fprintf(fp, " %x",
+				    (uint8_t)dav->dav_buf.buf[i]);
 			if (dw_loc_parse(&dav->dav_buf, &op, &oper1, NULL))
 				break;
-			printf("\t(%s %lld)", dw_op2name(op), oper1);
+			fprintf(fp, "\t(%s %lld)", dw_op2name(op), oper1);
 			break;
 		case DW_FORM_data1:
 		case DW_FORM_data2:
 		case DW_FORM_data4:
 		case DW_FORM_data8:
-			printf("0x%llx\t(location list)", val);
+			fprintf(fp, "0x%llx\t(location list)", val);
 			break;
 		default:
-			printf("%s", dw_form2name(form));
+			fprintf(fp, "%s", dw_form2name(form));
 			break;
 		}
 		break;
 	case DW_AT_type:
 	case DW_AT_sibling:
 	case DW_AT_abstract_origin:
-		printf("<%llx>", val + offset);
+		fprintf(fp, "<%llx>", val + offset);
 		break;
 	default:
-		printf("unimplemented: %s (%lld)", dw_form2name(form), val);
+		fprintf(fp, "unimplemented: %s (%lld)", dw_form2name(form),
+		    val);
 		break;
 	}
-	printf("\n");
+	fprintf(fp, "\n");
 }
 
 uint64_t
@@ -405,7 +1920,7 @@ dav2val(struct dwaval *dav, size_t psz)
 }
 
 const char *
-dav2str(struct dwaval *dav)
+dav2str(struct dwaval *dav, const struct dwbuf *dstr)
 {
 	const char *str = NULL;
 
@@ -414,7 +1929,11 @@ dav2str(struct dwaval *dav)
 		str = dav->dav_str;
 		break;
 	case DW_FORM_strp:
-		str = dstrbuf + dav->dav_u32;
+		if (dstr->buf == NULL || dav->dav_u32 >= dstr->len ||
+		    memchr(dstr->buf + dav->dav_u32, '\0',
+		    dstr->len - dav->dav_u32) == NULL)
+			break;
+		str = dstr->buf + dav->dav_u32;
 		break;
 	default:
 		break;
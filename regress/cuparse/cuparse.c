@@ -0,0 +1,266 @@
+/*
+ * Copyright (c) 2016 Martin Pieuchot
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Parse the units of .debug_info of ELF files into arrays of DIEs with
+ * dw_cu_parse() and check that walking them with dw_cu_walk() returns
+ * the same DIEs and values, once with the relocations applied to the
+ * section and once with the relocations resolved when values are read.
+ */
+
+#include <sys/types.h>
+#include <sys/exec_elf.h>
+#include <sys/queue.h>
+#include <err.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dwarf.h"
+#include "dw.h"
+#include "elfuncs.h"
+
+struct image {
+	const struct elfops	*ops;
+	struct elfsecidx	*esi;
+	struct dwbuf		 abbrev;
+	struct dwbuf		 info;
+	struct dwrelocs		 drs;
+	int			 cuflags;
+	struct dwabcache	 dac;
+	struct dwarena		 dar;
+};
+
+int	image_open(const char *, int, int, struct image *);
+void	image_close(struct image *);
+int	aval_cmp(const struct dwaval *, const struct dwaval *);
+int	die_cmp(const struct dwcu *, const struct dwdie *,
+	    const struct dwcu *, const struct dwdie *);
+int	check_file(const char *);
+
+/* Index ``fd'' and map its sections, relocating .debug_info unless lazy. */
+int
+image_open(const char *path, int fd, int lazy, struct image *im)
+{
+	char		 hdr[sizeof(Elf64_Ehdr)];
+	off_t		 size;
+	ssize_t		 idx;
+
+	memset(im, 0, sizeof(*im));
+	dw_abcache_init(&im->dac);
+	dw_arena_init(&im->dar);
+
+	size = lseek(fd, 0, SEEK_END);
+	if (size < (off_t)sizeof(hdr) ||
+	    pread(fd, hdr, sizeof(hdr), 0) != sizeof(hdr)) {
+		warnx("%s: too short", path);
+		return -1;
+	}
+
+	switch (hdr[EI_CLASS]) {
+	case ELFCLASS32:
+		im->ops = &elf32_ops;
+		break;
+	case ELFCLASS64:
+		im->ops = &elf64_ops;
+		break;
+	default:
+		warnx("%s: unexpected word size %u", path, hdr[EI_CLASS]);
+		return -1;
+	}
+	if (!im->ops->eo_iself(hdr, size))
+		return -1;
+	if (hdr[EI_DATA] == ELFDATA2MSB)
+		im->cuflags |= DW_CU_MSB;
+
+	im->esi = im->ops->eo_secidx_create(hdr, fd, 0, size);
+	if (im->esi == NULL)
+		return -1;
+
+	idx = im->ops->eo_getsection(im->esi, ".debug_abbrev", &im->abbrev.buf,
+	    &im->abbrev.len);
+	if (idx >= 0) {
+		if (lazy)
+			idx = im->ops->eo_getsection_lazy(im->esi, ".debug_info",
+			    &im->info.buf, &im->info.len, &im->drs);
+		else
+			idx = im->ops->eo_getsection(im->esi, ".debug_info",
+			    &im->info.buf, &im->info.len);
+	}
+	if (idx < 0) {
+		warnx("%s: no DWARF sections", path);
+		return -1;
+	}
+
+	return 0;
+}
+
+void
+image_close(struct image *im)
+{
+	dw_abcache_purge(&im->dac);
+	dw_arena_purge(&im->dar);
+	if (im->esi != NULL)
+		im->ops->eo_secidx_free(im->esi);
+}
+
+/*
+ * Compare two values of the same attribute.  Relocated blocks may have
+ * been copied, compare their content.
+ */
+int
+aval_cmp(const struct dwaval *a, const struct dwaval *b)
+{
+	if (a->dav_dat->dat_form != b->dav_dat->dat_form)
+		return 1;
+
+	switch (a->dav_dat->dat_form) {
+	case DW_FORM_block1:
+	case DW_FORM_block2:
+	case DW_FORM_block4:
+	case DW_FORM_block:
+	case DW_FORM_exprloc:
+		return (a->dav_buf.len != b->dav_buf.len ||
+		    memcmp(a->dav_buf.buf, b->dav_buf.buf, a->dav_buf.len));
+	case DW_FORM_string:
+		return strcmp(a->dav_str, b->dav_str);
+	default:
+		return (a->dav_u64 != b->dav_u64);
+	}
+}
+
+/* Compare DIEs of units that may come from different images. */
+int
+die_cmp(const struct dwcu *dcu, const struct dwdie *die,
+    const struct dwcu *wdcu, const struct dwdie *wdie)
+{
+	size_t		 i;
+
+	if (die == NULL || wdie == NULL)
+		return (die != wdie);
+
+	if (die->die_offset != wdie->die_offset ||
+	    die->die_dab->dab_code != wdie->die_dab->dab_code ||
+	    die->die_lvl != wdie->die_lvl)
+		return 1;
+
+	for (i = 0; i < die->die_dab->dab_nattrs; i++) {
+		if (aval_cmp(&dcu->dcu_avals[die->die_aval + i],
+		    &wdcu->dcu_avals[wdie->die_aval + i]))
+			return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Parse the units of the relocated image and walk them in both images.
+ * Stop at the first unit that cannot be parsed, like readdwarf does.
+ */
+int
+check_file(const char *path)
+{
+	struct image	 im[2];		/* relocated, lazy */
+	struct dwbuf	 info, walk[2];
+	struct dwarena	 wdar;
+	struct dwcu	*dcu, *wdcu;
+	struct dwdie	*die, *wdie;
+	size_t		 i, n, nunits = 0, ndies = 0;
+	int		 fd, rv = 0;
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		warn("%s", path);
+		return 1;
+	}
+
+	dw_arena_init(&wdar);
+	for (n = 0; n < 2; n++) {
+		if (image_open(path, fd, n, &im[n]) != 0)
+			rv = 1;
+		walk[n] = im[n].info;
+	}
+	info = im[0].info;
+
+	while (rv == 0 && dw_cu_parse(&info, &im[0].abbrev, im[0].info.len,
+	    NULL, &im[0].dac, &im[0].dar, im[0].cuflags, &dcu) == 0) {
+		for (n = 0; n < 2; n++) {
+			if (dw_cu_walk(&walk[n], &im[n].abbrev, im[n].info.len,
+			    &im[n].drs, &im[n].dac, &wdar, im[n].cuflags,
+			    &wdcu) != 0) {
+				warnx("%s: unit at offset 0x%zx: walk failed",
+				    path, dcu->dcu_offset);
+				rv = 1;
+				continue;
+			}
+
+			/* The walk must end where the array does. */
+			for (i = 0; i <= dcu->dcu_ndies; i++) {
+				die = (i < dcu->dcu_ndies) ?
+				    &dcu->dcu_dies[i] : NULL;
+				if (dw_die_next(wdcu, &wdie) != 0 ||
+				    die_cmp(dcu, die, wdcu, wdie))
+					break;
+			}
+			if (i <= dcu->dcu_ndies) {
+				warnx("%s: unit at offset 0x%zx: %s walk "
+				    "differs at DIE %zu", path,
+				    dcu->dcu_offset, n ? "lazy" : "relocated",
+				    i);
+				rv = 1;
+			}
+			dw_dcu_free(wdcu);
+		}
+
+		nunits++;
+		ndies += dcu->dcu_ndies;
+		dw_dcu_free(dcu);
+	}
+
+	if (rv == 0 && (nunits == 0 || info.len > 0)) {
+		warnx("%s: unit at offset 0x%zx: parse failed", path,
+		    im[0].info.len - info.len);
+		rv = 1;
+	}
+	if (rv == 0)
+		printf("%s: %zu units, %zu DIEs\n", path, nunits, ndies);
+
+	for (n = 0; n < 2; n++)
+		image_close(&im[n]);
+	dw_arena_purge(&wdar);
+	close(fd);
+
+	return rv;
+}
+
+int
+main(int argc, char *argv[])
+{
+	int		 i, rv = 0;
+
+	if (argc < 2) {
+		fprintf(stderr, "usage: cuparse file ...\n");
+		return 1;
+	}
+
+	for (i = 1; i < argc; i++)
+		rv |= check_file(argv[i]);
+
+	return rv;
+}
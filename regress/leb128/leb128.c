@@ -0,0 +1,170 @@
+/*
+ * Copyright (c) 2016 Martin Pieuchot
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Compare dw_read_leb128() with the byte-wise loop it replaced on random
+ * encodings of 1 to 12 bytes, signed and unsigned, followed by 0 to 12
+ * bytes so that both the fast path and the checked tail are taken.
+ * Encodings longer than 10 bytes and truncated ones must fail the same
+ * way.  The time spent by each decoder is printed, measured on the first
+ * encodings only, so that they stay in the cache.
+ */
+
+#include <err.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "dw.c"
+
+#define NENCODINGS	(1000 * 1000)
+#define MAXENCODING	12
+#define MAXTAIL		12
+#define NTIMED		4096
+#define NROUNDS		1000
+
+struct enc {
+	size_t		 off;	/* in the buffer */
+	size_t		 len;	/* left in the buffer */
+	int		 signextend;
+};
+
+static uint64_t	 seed = 0x9e3779b97f4a7c15ULL;
+
+static uint64_t
+rnd(void)
+{
+	/* xorshift64*, the same sequence on every run. */
+	seed ^= seed >> 12;
+	seed ^= seed << 25;
+	seed ^= seed >> 27;
+	return seed * 0x2545f4914f6cdd1dULL;
+}
+
+/* The decoder before the fast path was added. */
+static int
+leb128_ref(struct dwbuf *d, uint64_t *v, int signextend)
+{
+	unsigned int shift = 0;
+	uint64_t res = 0;
+	uint8_t x;
+
+	while (shift < 64 && !dw_read_u8(d, &x)) {
+		res |= (uint64_t)(x & 0x7f) << shift;
+		shift += 7;
+		if ((x & 0x80) == 0) {
+			if (signextend && shift < 64 && (x & 0x40) != 0)
+				res |= ~(uint64_t)0 << shift;
+			*v = res;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+static double
+elapsed(const struct timespec *start)
+{
+	struct timespec	 now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) +
+	    (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct timespec	 start;
+	struct dwbuf	 d1, d2;
+	struct enc	*encs;
+	uint8_t		*buf;
+	uint64_t	 v1, v2, sum = 0;
+	size_t		 i, j, n, r, tail, off = 0;
+	int		 rv1, rv2, nfail = 0;
+	double		 tfast, tref;
+
+	encs = calloc(NENCODINGS, sizeof(*encs));
+	buf = malloc(NENCODINGS * (MAXENCODING + MAXTAIL));
+	if (encs == NULL || buf == NULL)
+		err(1, NULL);
+
+	for (i = 0; i < NENCODINGS; i++) {
+		n = 1 + rnd() % MAXENCODING;
+		tail = rnd() % (MAXTAIL + 1);
+		for (j = 0; j < n + tail; j++)
+			buf[off + j] = rnd();
+		for (j = 0; j < n - 1; j++)
+			buf[off + j] |= 0x80;
+		buf[off + n - 1] &= 0x7f;
+
+		encs[i].off = off;
+		encs[i].signextend = rnd() & 1;
+		/* Some encodings are cut by the end of the buffer. */
+		if (rnd() % 16 == 0)
+			encs[i].len = rnd() % n;
+		else
+			encs[i].len = n + tail;
+		off += n + tail;
+	}
+
+	for (i = 0; i < NENCODINGS; i++) {
+		d1.buf = d2.buf = (const char *)buf + encs[i].off;
+		d1.len = d2.len = encs[i].len;
+		v1 = v2 = 0;
+		rv1 = dw_read_leb128(&d1, &v1, encs[i].signextend);
+		rv2 = leb128_ref(&d2, &v2, encs[i].signextend);
+		if (rv1 != rv2 || (rv1 == 0 && (v1 != v2 || d1.len != d2.len))) {
+			warnx("encoding %zu: got %d 0x%llx %zu, expected "
+			    "%d 0x%llx %zu", i, rv1, (unsigned long long)v1,
+			    d1.len, rv2, (unsigned long long)v2, d2.len);
+			if (++nfail > 10)
+				break;
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (r = 0; r < NROUNDS; r++) {
+		for (i = 0; i < NTIMED; i++) {
+			d1.buf = (const char *)buf + encs[i].off;
+			d1.len = encs[i].len;
+			if (dw_read_leb128(&d1, &v1, encs[i].signextend) == 0)
+				sum += v1;
+		}
+	}
+	tfast = elapsed(&start);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (r = 0; r < NROUNDS; r++) {
+		for (i = 0; i < NTIMED; i++) {
+			d2.buf = (const char *)buf + encs[i].off;
+			d2.len = encs[i].len;
+			if (leb128_ref(&d2, &v2, encs[i].signextend) == 0)
+				sum -= v2;
+		}
+	}
+	tref = elapsed(&start);
+
+	/* ``sum'' is 0 if both decoders agree, printed to keep the loops. */
+	printf("%d encodings checked, %.1f ns per value, %.1f ns with the "
+	    "byte loop (%llx)\n", NENCODINGS,
+	    tfast * 1e9 / (NROUNDS * NTIMED), tref * 1e9 / (NROUNDS * NTIMED),
+	    (unsigned long long)sum);
+
+	free(buf);
+	free(encs);
+
+	return (nfail > 0);
+}